@@ -0,0 +1,53 @@
+/*
+ * si5351-iio-ioctl.h: binary interface of the si5351-iio character device
+ *
+ * Licensed under the GPL-2.
+ *
+ * Every chip registers /dev/si5351-<i2c device name>. The ioctls below take
+ * packed structs instead of the text of the IIO attributes, and the vector
+ * variants handle several channels per system call. Frequencies are in Hz,
+ * phases in degrees.
+ */
+
+#ifndef _SI5351_IIO_IOCTL_H
+#define _SI5351_IIO_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* keep the channel's current phase and ignore the phase field */
+#define SI5351_TUNE_KEEP_PHASE	(1 << 0)
+
+struct si5351_ioc_tune {
+	__u32	channel;
+	__u32	flags;
+	__u32	freq;
+	__u32	phase;
+};
+
+/* a vector of tunes, at most one per channel */
+struct si5351_ioc_vec {
+	__u64	tunes;		/* user pointer to struct si5351_ioc_tune[count] */
+	__u32	count;
+	__u32	flags;		/* must be 0 */
+};
+
+#define SI5351_IOC_MAGIC	0xb5
+
+/*
+ * SET tunes one channel, GET reads its current frequency and phase, QUERY
+ * returns what a SET would produce without touching the chip. SET and
+ * QUERY return the realised values in freq and phase.
+ */
+#define SI5351_IOC_SET		_IOWR(SI5351_IOC_MAGIC, 0, struct si5351_ioc_tune)
+#define SI5351_IOC_GET		_IOWR(SI5351_IOC_MAGIC, 1, struct si5351_ioc_tune)
+#define SI5351_IOC_QUERY	_IOWR(SI5351_IOC_MAGIC, 2, struct si5351_ioc_tune)
+
+/*
+ * SUBMIT applies all tunes of the vector as one transaction with a single
+ * commit and writes the realised values back, GETV reads the listed channels.
+ */
+#define SI5351_IOC_SUBMIT	_IOWR(SI5351_IOC_MAGIC, 3, struct si5351_ioc_vec)
+#define SI5351_IOC_GETV		_IOWR(SI5351_IOC_MAGIC, 4, struct si5351_ioc_vec)
+
+#endif /* _SI5351_IIO_IOCTL_H */
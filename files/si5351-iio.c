@@ -9,646 +9,4145 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/rational.h>
+#include <linux/gcd.h>
+#include <linux/math64.h>
 #include <linux/i2c.h>
 #include <linux/slab.h>
 #include <linux/sysfs.h>
 #include <linux/regulator/consumer.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/seqlock.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <asm/unaligned.h>
 #include <asm/div64.h>
 
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 
 #include "si5351_defs.h"
+#include "si5351-iio-ioctl.h"
 #include "si5351-iio.h"
 
+#define CREATE_TRACE_POINTS
+#include "si5351-trace.h"
+
 static ssize_t si5351_write_ext(struct iio_dev *indio_dev,
 				    uintptr_t private,
 				    const struct iio_chan_spec *chan,
 				    const char *buf, size_t len)
 {
 	struct si5351_state *st = iio_priv(indio_dev);
-	struct i2c_client *i2c = to_i2c_client(st->dev);
+	unsigned int freq[SI5351_MAX_CHANNELS], phase[SI5351_MAX_CHANNELS];
+	unsigned int output = chan->channel;
 	unsigned long long readin;
-	unsigned int phase, new_freq, new_phase;
 	int ret;
 
 	ret = kstrtoull(buf, 10, &readin);
 	if (ret)
 		return ret;
 
-	mutex_lock(&indio_dev->mlock);
+	if (READ_ONCE(st->async_mode)) {
+		ret = si5351_async_queue(st, output, (u32)private, (unsigned int)readin);
+		return ret ? ret : len;
+	}
+
+	/* a group is retuned as a whole and the phases of its members are fixed */
+	if (si5351_output_group(st, output) >= 0) {
+		if ((u32)private == SI5351_PHASE)
+			return -EINVAL;
+		output = si5351_group_output(st, output);
+	}
+
 	switch ((u32)private) {
 	case SI5351_FREQ:
-		if (st->quad_mode)
-		{
-			st->fVCO = si5351_retune_pll_and_config_msynth_quad(i2c, PLL_A, st->xtal_rate, (unsigned int)readin, &new_freq, &new_phase);
-			si5351_ctrl_msynth(i2c, 0, 1, SI5351_CLK_INPUT_MULTISYNTH_N, SI5351_CLK_DRIVE_STRENGTH_8MA, 0);
-			si5351_ctrl_msynth(i2c, 1, 1, SI5351_CLK_INPUT_MULTISYNTH_N, SI5351_CLK_DRIVE_STRENGTH_8MA, 0);
-		}
-		else
-		{
-			ret = si5351_config_msynth_phase(i2c, chan->channel, PLL_A, (unsigned int)readin, st->fVCO, st->phase_cache[chan->channel], &new_freq, &new_phase);
-			si5351_ctrl_msynth(i2c, chan->channel, 1, SI5351_CLK_INPUT_MULTISYNTH_N, SI5351_CLK_DRIVE_STRENGTH_8MA, 0);
-		}
-		ret = 0;
+		freq[output] = (unsigned int)readin;
+		phase[output] = SI5351_TUNE_KEEP;
 		break;
 	case SI5351_PHASE:
-		if (st->quad_mode)
+		if (readin >= 360)
+			return -EINVAL;
+		freq[output] = SI5351_TUNE_KEEP;
+		phase[output] = (unsigned int)readin;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ret = si5351_txn_commit(st, BIT(output), freq, phase, NULL, NULL);
+
+	return ret ? ret : len;
+}
+
+/*
+ * PLL ping-pong hopping: "hop_frequency" programs the next frequency on the
+ * PLL the output is not using, keeping its multisynth divider, and lets it
+ * lock in the background. "hop_commit" then only flips the PLL select bit
+ * in the output's CTRL register, a single byte on the bus.
+ */
+static ssize_t si5351_write_hop(struct iio_dev *indio_dev,
+				uintptr_t private,
+				const struct iio_chan_spec *chan,
+				const char *buf, size_t len)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+	unsigned long long readin;
+	unsigned int output = chan->channel;
+	unsigned int pll, idle;
+	u8 reset = 0;
+	int ret;
+
+	ret = kstrtoull(buf, 10, &readin);
+	if (ret)
+		return ret;
+
+	si5351_lock_all(st);
+	pll = si5351_output_pll(st, output);
+	idle = (pll == PLL_A) ? PLL_B : PLL_A;
+
+	switch ((u32)private) {
+	case SI5351_HOP_FREQ:
+		ret = si5351_prepare_hop(st, output, idle, (unsigned int)readin);
+		if (ret == 0)
+			reset = st->commit_reset;
+		break;
+	case SI5351_HOP_COMMIT:
+		if (!readin)
+			break;
+		if (st->hop_owner[idle] != output + 1) {
 			ret = -EINVAL;
-		else
-		{
-			if (readin<180)
-				phase = (unsigned int)readin;
-			else
-				phase = (unsigned int)(readin-180);
-			ret = si5351_config_msynth_phase(i2c, chan->channel, PLL_A, st->freq_cache[chan->channel], st->fVCO, phase, &new_freq, &new_phase);
-			si5351_ctrl_msynth(i2c, chan->channel, 1, SI5351_CLK_INPUT_MULTISYNTH_N, SI5351_CLK_DRIVE_STRENGTH_8MA, (readin<180)?0:1);
-			if (!(readin<180))
-				new_phase += 180;
-			ret = 0;
+			break;
+		}
+		si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, SI5351_CLK_PLL_SELECT,
+					 (idle == PLL_B) ? SI5351_CLK_PLL_SELECT : 0);
+		ret = si5351_commit(st);
+		if (ret == 0) {
+			si5351_update_caches(st, output, st->hop_freq[output], st->phase_cache[output]);
+			st->hop_freq[output] = 0;
+			st->hop_owner[idle] = 0;
+			/* the hop table was compiled for the PLL just left */
+			if (output == st->hop_channel)
+				st->hop_len = 0;
 		}
 		break;
 	default:
 		ret = -EINVAL;
 	}
-
 	if (ret == 0)
-	{
-		if (st->quad_mode)
-		{
-			st->freq_cache[0] = new_freq;
-			st->freq_cache[1] = new_freq;
-			st->phase_cache[0] = 0;
-			st->phase_cache[1] = new_phase;
-		}
-		else
-		{
-			st->freq_cache[chan->channel] = new_freq;
-			st->phase_cache[chan->channel] = new_phase;
-		}
+		ret = si5351_unlock_all_wait(st, reset);
+	else
+		si5351_unlock_all(st);
+
+	return ret ? ret : len;
+}
+
+/*
+ * Dry run: solve for a target without staging or sending anything, so
+ * userspace can evaluate what a setting would produce before applying it.
+ * Writes take "<frequency> [<phase>]", reads return the result of the last
+ * query as "<frequency> <phase> <a> <b> <c> <p1> <p2> <p3> <error>".
+ */
+static ssize_t si5351_write_query(struct iio_dev *indio_dev,
+				  uintptr_t private,
+				  const struct iio_chan_spec *chan,
+				  const char *buf, size_t len)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct si5351_query *q = &st->query[chan->channel];
+	unsigned int freq, phase = 0;
+	unsigned int plls;
+	int ret;
+
+	ret = sscanf(buf, "%u %u", &freq, &phase);
+	if (ret < 1)
+		return -EINVAL;
+	if (phase >= 360)
+		return -EINVAL;
+
+	plls = si5351_lock_plls(st, BIT(chan->channel));
+	ret = si5351_query_solution(st, chan->channel, freq, phase, &q->sol);
+	if (ret == 0) {
+		q->fout_target = freq;
+		q->phase_target = phase;
 	}
-	mutex_unlock(&indio_dev->mlock);
+	si5351_unlock_plls(st, plls);
 
 	return ret ? ret : len;
 }
 
-static ssize_t si5351_read_ext(struct iio_dev *indio_dev,
-				   uintptr_t private,
-				   const struct iio_chan_spec *chan,
-				   char *buf)
+static ssize_t si5351_read_query(struct iio_dev *indio_dev,
+				 uintptr_t private,
+				 const struct iio_chan_spec *chan,
+				 char *buf)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct si5351_query q;
+	unsigned int plls;
+
+	plls = si5351_lock_plls(st, BIT(chan->channel));
+	q = st->query[chan->channel];
+	si5351_unlock_plls(st, plls);
+
+	return sprintf(buf, "%u %u %lu %lu %lu %lu %lu %lu %lld\n",
+		       q.sol.fout_real, q.sol.phase_real,
+		       q.sol.a, q.sol.b, q.sol.c,
+		       q.sol.msynth.p1, q.sol.msynth.p2, q.sol.msynth.p3,
+		       (long long)q.sol.fout_real - q.fout_target);
+}
+
+static ssize_t si5351_read_hop(struct iio_dev *indio_dev,
+			       uintptr_t private,
+			       const struct iio_chan_spec *chan,
+			       char *buf)
 {
 	struct si5351_state *st = iio_priv(indio_dev);
 	unsigned long long val;
 	int ret = 0;
 
-	mutex_lock(&indio_dev->mlock);
+	mutex_lock(&st->bus_lock);
 	switch ((u32)private) {
-	case SI5351_FREQ:
-		val = st->freq_cache[chan->channel];
+	case SI5351_HOP_FREQ:
+		val = st->hop_freq[chan->channel];
 		break;
-	case SI5351_PHASE:
-		val = st->phase_cache[chan->channel];
+	case SI5351_HOP_COMMIT:
+		/* 1 while a prepared hop is waiting to be committed */
+		val = st->hop_freq[chan->channel] ? 1 : 0;
 		break;
 	default:
 		ret = -EINVAL;
 		val = 0;
 	}
-	mutex_unlock(&indio_dev->mlock);
+	mutex_unlock(&st->bus_lock);
 
 	return ret < 0 ? ret : sprintf(buf, "%llu\n", val);
 }
 
+static ssize_t si5351_read_ext(struct iio_dev *indio_dev,
+				   uintptr_t private,
+				   const struct iio_chan_spec *chan,
+				   char *buf)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+	unsigned int freq, phase;
 
+	/* lock-free, a retune in progress never stalls the reader */
+	si5351_read_caches(st, chan->channel, &freq, &phase);
 
-static const struct iio_info si5351_info = {
-};
+	switch ((u32)private) {
+	case SI5351_FREQ:
+		return sprintf(buf, "%u\n", freq);
+	case SI5351_PHASE:
+		return sprintf(buf, "%u\n", phase);
+	default:
+		return -EINVAL;
+	}
+}
 
-static const struct iio_chan_spec_ext_info si5351_ext_info[] = {
-{ \
-	.name = "frequency", \
-	.read = si5351_read_ext, \
-	.write = si5351_write_ext, \
-	.private = SI5351_FREQ, \
-	.shared = IIO_SEPARATE, \
-},
-{ \
-	.name = "phase", \
-	.read = si5351_read_ext, \
-	.write = si5351_write_ext, \
-	.private = SI5351_PHASE, \
-	.shared = IIO_SEPARATE, \
-},
-	{ },
+
+
+/*
+ * "frequency_exact" takes a target in Hz with up to three decimals and
+ * tunes to it with si5351_solve_exact(). Reading it returns the frequency
+ * the registers actually produce to 1 uHz, followed by the error against
+ * the target if the last tune was an exact one.
+ */
+static ssize_t si5351_write_exact(struct iio_dev *indio_dev,
+				  uintptr_t private,
+				  const struct iio_chan_spec *chan,
+				  const char *buf, size_t len)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+	int integer, fract, ret;
+
+	ret = iio_str_to_fixpoint(buf, 100, &integer, &fract);
+	if (ret)
+		return ret;
+	if (integer < 0 || fract < 0)
+		return -EINVAL;
+
+	ret = si5351_tune_exact(st, chan->channel, (u64)integer * 1000 + fract);
+
+	return ret ? ret : len;
+}
+
+static ssize_t si5351_read_exact(struct iio_dev *indio_dev,
+				 uintptr_t private,
+				 const struct iio_chan_spec *chan,
+				 char *buf)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+	unsigned int output = chan->channel;
+	unsigned int plls;
+	u64 fout, hz;
+	u32 rem;
+	int ret;
+
+	plls = si5351_lock_plls(st, BIT(output));
+	ret = si5351_exact_rate(st, output, &fout);
+	si5351_unlock_plls(st, plls);
+	if (ret < 0)
+		return ret;
+
+	/* rem is only valid once div_u64_rem() has returned */
+	hz = div_u64_rem(fout, 1000000, &rem);
+	ret = sprintf(buf, "%llu.%06u", hz, rem);
+	if (READ_ONCE(st->tune_path[output]) == SI5351_PATH_EXACT)
+		ret += sprintf(buf + ret, " %lld",
+			       (long long)(fout - READ_ONCE(st->exact_target[output]) * 1000));
+
+	return ret + sprintf(buf + ret, "\n");
+}
+
+static const char * const si5351_tune_paths[] = {
+	[SI5351_PATH_NONE] = "none",
+	[SI5351_PATH_MSYNTH] = "msynth",
+	[SI5351_PATH_PLL] = "pll",
+	[SI5351_PATH_REPLAN] = "replan",
+	[SI5351_PATH_GROUP] = "group",
+	[SI5351_PATH_EXACT] = "exact",
 };
 
-#define SI5351_CHANNEL(chan, _ext_info) {		\
-	.type = IIO_VOLTAGE,					\
-	.indexed = 1,						\
-	.output = 1,						\
-	.channel = (chan),					\
-	.info_mask_separate = 0,				\
-	.ext_info = (_ext_info),				\
+/*
+ * "fine_tune" turns the PLL-only fine-tune mode of a channel on or off,
+ * see si5351_solve_fine(). "tune_path" tells how its last tune was done.
+ */
+static ssize_t si5351_read_fine(struct iio_dev *indio_dev,
+				uintptr_t private,
+				const struct iio_chan_spec *chan,
+				char *buf)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+
+	switch ((u32)private) {
+	case SI5351_FINE_TUNE:
+		return sprintf(buf, "%d\n", test_bit(chan->channel, &st->fine_mask));
+	case SI5351_TUNE_PATH:
+		return sprintf(buf, "%s\n", si5351_tune_paths[READ_ONCE(st->tune_path[chan->channel])]);
+	default:
+		return -EINVAL;
+	}
 }
 
-#define DECLARE_SI5351C_CHANNELS(name, ext_info) \
-const struct iio_chan_spec name[] = { \
-	SI5351_CHANNEL(0, ext_info), \
-	SI5351_CHANNEL(1, ext_info), \
-	SI5351_CHANNEL(2, ext_info), \
-	SI5351_CHANNEL(3, ext_info), \
-	SI5351_CHANNEL(4, ext_info), \
-	SI5351_CHANNEL(5, ext_info), \
-	SI5351_CHANNEL(6, ext_info), \
-	SI5351_CHANNEL(7, ext_info), \
+static ssize_t si5351_write_fine(struct iio_dev *indio_dev,
+				 uintptr_t private,
+				 const struct iio_chan_spec *chan,
+				 const char *buf, size_t len)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+	bool val;
+	int ret;
+
+	if ((u32)private != SI5351_FINE_TUNE)
+		return -EINVAL;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	if (val)
+		set_bit(chan->channel, &st->fine_mask);
+	else
+		clear_bit(chan->channel, &st->fine_mask);
+
+	return len;
 }
 
-#define DECLARE_SI5351A_CHANNELS(name, ext_info) \
-const struct iio_chan_spec name[] = { \
-	SI5351_CHANNEL(0, ext_info), \
-	SI5351_CHANNEL(1, ext_info), \
-	SI5351_CHANNEL(2, ext_info), \
+static ssize_t si5351_show_stat(struct device *dev,
+				struct device_attribute *attr,
+				char *buf)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	unsigned long long val;
+	int ret = 0;
+
+	mutex_lock(&st->bus_lock);
+	mutex_lock(&st->tune_cache_lock);
+	switch ((u32)this_attr->address) {
+	case SI5351_STAT_LAST_TUNE_BYTES:
+		val = st->last_tune_bytes;
+		break;
+	case SI5351_STAT_TOTAL_TUNE_BYTES:
+		val = st->total_tune_bytes;
+		break;
+	case SI5351_STAT_COMMITS:
+		val = st->commits;
+		break;
+	case SI5351_STAT_TUNE_CACHE_SIZE:
+		val = st->tune_cache_size;
+		break;
+	case SI5351_STAT_TUNE_CACHE_HITS:
+		val = st->tune_cache_hits;
+		break;
+	case SI5351_STAT_TUNE_CACHE_MISSES:
+		val = st->tune_cache_misses;
+		break;
+	default:
+		ret = -EINVAL;
+		val = 0;
+	}
+	mutex_unlock(&st->tune_cache_lock);
+	mutex_unlock(&st->bus_lock);
+
+	return ret < 0 ? ret : sprintf(buf, "%llu\n", val);
 }
 
+static ssize_t si5351_store_tune_cache_size(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	unsigned int size;
+	int ret;
 
-static DECLARE_SI5351A_CHANNELS(si5351a_channels, si5351_ext_info);
-static DECLARE_SI5351C_CHANNELS(si5351c_channels, si5351_ext_info);
+	ret = kstrtouint(buf, 10, &size);
+	if (ret)
+		return ret;
+	if (size > SI5351_TUNE_CACHE_MAX)
+		return -EINVAL;
 
-static const struct si5351_chip_info si5351_chip_info_tbl[] = {
-	[ID_SI5351A] = {
-		.channels = si5351a_channels,
-		.num_channels = 3,
-	},
-	[ID_SI5351C] = {
-		.channels = si5351c_channels,
-		.num_channels = 8,
-	},
-};
+	mutex_lock(&st->tune_cache_lock);
+	si5351_tune_cache_flush(st);
+	st->tune_cache_size = size;
+	st->tune_cache_hits = 0;
+	st->tune_cache_misses = 0;
+	mutex_unlock(&st->tune_cache_lock);
 
-static void si5351_write_parameters(struct i2c_client *i2c,
-				    unsigned int start_reg, struct si5351_multisynth_parameters *params)
+	return len;
+}
+
+static ssize_t si5351_show_hop(struct device *dev,
+			       struct device_attribute *attr,
+			       char *buf)
 {
-	u8 buf[SI5351_PARAMETERS_LENGTH];
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	s64 lat_avg;
+	ssize_t len = 0;
+	unsigned int i;
 
-	switch (start_reg) {
-	case SI5351_CLK6_PARAMETERS:
-	case SI5351_CLK7_PARAMETERS:
-		buf[0] = params->p1 & 0xff;
-		i2c_smbus_write_byte_data(i2c, start_reg, buf[0]);
+	mutex_lock(&st->bus_lock);
+	switch ((u32)this_attr->address) {
+	case SI5351_HOP_TABLE:
+		for (i = 0; i < st->hop_len; i++)
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%u:%u\n",
+					 st->hop_table[i].fout_real,
+					 st->hop_table[i].phase_real);
+		break;
+	case SI5351_HOP_CHANNEL:
+		len = sprintf(buf, "%u\n", st->hop_channel);
+		break;
+	case SI5351_HOP_DWELL:
+		len = sprintf(buf, "%lld\n", ktime_to_us(st->hop_dwell));
+		break;
+	case SI5351_HOP_LOOP:
+		len = sprintf(buf, "%d\n", st->hop_loop);
+		break;
+	case SI5351_HOP_RUN:
+		len = sprintf(buf, "%d\n", st->seq_running && st->seq_mode == SI5351_SEQ_HOP);
+		break;
+	case SI5351_HOP_STATS:
+		lat_avg = st->seq_steps ? div64_s64(st->seq_lat_sum, st->seq_steps) : 0;
+		len = sprintf(buf, "%llu %llu %lld %lld %lld %lld %lld\n",
+			      st->seq_steps, st->seq_missed,
+			      st->seq_lat_min, lat_avg, st->seq_lat_max,
+			      st->seq_interval_min, st->seq_interval_max);
 		break;
 	default:
-		buf[0] = ((params->p3 & 0x0ff00) >> 8) & 0xff;
-		buf[1] = params->p3 & 0xff;
-		/* save rdiv and divby4 */
-		buf[2] = i2c_smbus_read_byte_data(i2c, start_reg + 2) & ~0x03;
-		buf[2] |= ((params->p1 & 0x30000) >> 16) & 0x03;
-		buf[3] = ((params->p1 & 0x0ff00) >> 8) & 0xff;
-		buf[4] = params->p1 & 0xff;
-		buf[5] = ((params->p3 & 0xf0000) >> 12) |
-			((params->p2 & 0xf0000) >> 16);
-		buf[6] = ((params->p2 & 0x0ff00) >> 8) & 0xff;
-		buf[7] = params->p2 & 0xff;
-		dev_dbg(&i2c->dev, "si5351a-iio: writing %02x %02x %02x %02x %02x %02x %02x %02x at reg %d\n",buf[0],buf[1],buf[2],buf[3],buf[4],buf[5],buf[6],buf[7],start_reg);
-		i2c_smbus_write_i2c_block_data(i2c, start_reg, SI5351_PARAMETERS_LENGTH, buf);
+		len = -EINVAL;
 	}
+	mutex_unlock(&st->bus_lock);
+
+	return len;
 }
 
-static int si5351_setup_pll(struct i2c_client *i2c, unsigned int pll, unsigned int fVCO, unsigned int fXTAL)
+static int si5351_parse_hop_table(struct si5351_state *st, char *table)
 {
-	struct si5351_multisynth_parameters params;
-	unsigned long rfrac, denom, a, b, c;
-		unsigned long long lltmp;
-		int val;
+	struct si5351_hop_entry *entry;
+	unsigned int freq, phase, n = 0;
+	char *token;
+	int ret;
 
-		unsigned int start_reg = (pll == PLL_A) ? SI5351_PLLA_PARAMETERS : SI5351_PLLB_PARAMETERS;
+	while ((token = strsep(&table, " \t\n,")) != NULL) {
+		if (!*token)
+			continue;
+		if (n == SI5351_HOP_TABLE_MAX)
+			return -E2BIG;
 
-		if (fVCO < SI5351_PLL_VCO_MIN)
-			fVCO = SI5351_PLL_VCO_MIN;
-		if (fVCO > SI5351_PLL_VCO_MAX)
-			fVCO = SI5351_PLL_VCO_MAX;
+		phase = 0;
+		ret = sscanf(token, "%u:%u", &freq, &phase);
+		if (ret < 1 || phase >= 360)
+			return -EINVAL;
 
-		/* determine integer part of feedback equation */
-		a = fVCO / fXTAL;
+		entry = &st->hop_table[n++];
+		si5351_hop_compile(st, st->hop_channel, freq, phase, entry);
+	}
 
-		if (a < SI5351_PLL_A_MIN)
-			fVCO = fXTAL * SI5351_PLL_A_MIN;
-		if (a > SI5351_PLL_A_MAX)
-			fVCO = fXTAL * SI5351_PLL_A_MAX;
+	return n;
+}
 
-		/* find best approximation for b/c = fVCO mod fIN */
-		denom = 1000 * 1000;
-		lltmp = fVCO % fXTAL;
-		lltmp *= denom;
-		do_div(lltmp, fXTAL);
-		rfrac = (unsigned long)lltmp;
+static ssize_t si5351_store_hop(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	unsigned int val = 0;
+	char *table;
+	int ret = 0;
 
-		b = 0;
-		c = 1;
-		if (rfrac)
-			rational_best_approximation(rfrac, denom,
-					    SI5351_PLL_B_MAX, SI5351_PLL_C_MAX, &b, &c);
+	if ((u32)this_attr->address != SI5351_HOP_TABLE) {
+		ret = kstrtouint(buf, 10, &val);
+		if (ret)
+			return ret;
+	}
 
-		/* calculate parameters */
-		params.p3  = c;
-		params.p2  = (128 * b) % c;
-		params.p1  = 128 * a;
-		params.p1 += (128 * b / c);
-		params.p1 -= 512;
+	/* stopping waits for the worker, which takes the locks itself */
+	if ((u32)this_attr->address == SI5351_HOP_RUN && !val) {
+		si5351_seq_stop(st);
+		return len;
+	}
 
-		/* recalculate rate by fIN * (a + b/c) */
-		lltmp  = fXTAL;
-		lltmp *= b;
-		do_div(lltmp, c);
+	si5351_lock_all(st);
+	switch ((u32)this_attr->address) {
+	case SI5351_HOP_TABLE:
+		if (st->seq_running) {
+			ret = -EBUSY;
+			break;
+		}
+		if (st->group_mask) {
+			ret = -EINVAL;
+			break;
+		}
+		table = kstrndup(buf, len, GFP_KERNEL);
+		if (!table) {
+			ret = -ENOMEM;
+			break;
+		}
+		st->hop_len = 0;
+		ret = si5351_parse_hop_table(st, table);
+		kfree(table);
+		if (ret >= 0) {
+			st->hop_len = ret;
+			ret = 0;
+		}
+		break;
+	case SI5351_HOP_CHANNEL:
+		if (st->seq_running) {
+			ret = -EBUSY;
+			break;
+		}
+		if (val >= st->chip_info->num_channels) {
+			ret = -EINVAL;
+			break;
+		}
+		/* the table was compiled for the old channel */
+		st->hop_channel = val;
+		st->hop_len = 0;
+		break;
+	case SI5351_HOP_DWELL:
+		if (val < SI5351_SEQ_MIN_DWELL_US) {
+			ret = -EINVAL;
+			break;
+		}
+		st->hop_dwell = us_to_ktime(val);
+		break;
+	case SI5351_HOP_LOOP:
+		st->hop_loop = !!val;
+		break;
+	case SI5351_HOP_RUN:
+		if (!st->hop_len) {
+			ret = -EINVAL;
+			break;
+		}
+		st->hop_pos = 0;
+		ret = si5351_seq_start(st, SI5351_SEQ_HOP, st->hop_dwell);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+	si5351_unlock_all(st);
+
+	return ret ? ret : len;
+}
+
+static ssize_t si5351_show_async(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	ssize_t len;
+
+	spin_lock(&st->async_lock);
+	switch ((u32)this_attr->address) {
+	case SI5351_ASYNC_MODE:
+		len = sprintf(buf, "%d\n", st->async_mode);
+		break;
+	case SI5351_ASYNC_GENERATION:
+		len = sprintf(buf, "%llu\n", st->async_gen);
+		break;
+	case SI5351_ASYNC_STATS:
+		len = sprintf(buf, "%llu %llu %llu %llu\n",
+			      st->async_received, st->async_applied,
+			      st->async_coalesced, st->async_errors);
+		break;
+	default:
+		len = -EINVAL;
+	}
+	spin_unlock(&st->async_lock);
+
+	return len;
+}
+
+static ssize_t si5351_store_async_mode(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(st->async_mode, !!val);
+	/* targets still pending are applied before synchronous writes resume */
+	if (!val)
+		flush_work(&st->async_work);
+
+	return len;
+}
+
+/*
+ * Transactions: "txn_stage" collects frequency and phase for any set of
+ * channels, "txn_commit" solves all of them into the image and sends them
+ * with one commit, so the outputs never pass through intermediate states.
+ */
+static ssize_t si5351_show_txn(struct device *dev,
+			       struct device_attribute *attr,
+			       char *buf)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	ssize_t len = 0;
+	unsigned int ch;
+
+	mutex_lock(&st->bus_lock);
+	for_each_set_bit(ch, &st->txn_mask, SI5351_MAX_CHANNELS)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u %u %u\n",
+				 ch, st->txn_freq[ch], st->txn_phase[ch]);
+	mutex_unlock(&st->bus_lock);
+
+	return len;
+}
+
+/*
+ * Check one tune of a transaction. One frequency retunes a whole output
+ * group, so its members map to the group's first output, and their phases
+ * can only be given as configured.
+ */
+static int si5351_txn_check(struct si5351_state *st, unsigned int *ch, unsigned int phase)
+{
+	int group;
+
+	if (*ch >= st->chip_info->num_channels ||
+	    (phase >= 360 && phase != SI5351_TUNE_KEEP))
+		return -EINVAL;
+
+	group = si5351_output_group(st, *ch);
+	if (group >= 0) {
+		if (phase != SI5351_TUNE_KEEP && phase != st->groups[group].phase[*ch])
+			return -EINVAL;
+		*ch = si5351_group_output(st, *ch);
+	}
+
+	return 0;
+}
+
+/* every line is "<channel> <frequency> [<phase>]", nothing is staged on error */
+static int si5351_parse_txn(struct si5351_state *st, char *lines)
+{
+	unsigned int freq[SI5351_MAX_CHANNELS], phase[SI5351_MAX_CHANNELS];
+	unsigned long mask = 0;
+	unsigned int ch, f, p;
+	char *line;
+	int ret;
+
+	while ((line = strsep(&lines, "\n;")) != NULL) {
+		line = strim(line);
+		if (!*line)
+			continue;
+
+		ret = sscanf(line, "%u %u %u", &ch, &f, &p);
+		if (ret < 2 || ch >= st->chip_info->num_channels)
+			return -EINVAL;
+		if (ret < 3)
+			p = (mask & BIT(ch)) ? phase[ch] :
+			    (st->txn_mask & BIT(ch)) ? st->txn_phase[ch] :
+			    (si5351_output_group(st, ch) >= 0) ? SI5351_TUNE_KEEP : st->phase_cache[ch];
+		if (si5351_txn_check(st, &ch, p))
+			return -EINVAL;
+
+		freq[ch] = f;
+		phase[ch] = p;
+		mask |= BIT(ch);
+	}
+
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS) {
+		st->txn_freq[ch] = freq[ch];
+		st->txn_phase[ch] = phase[ch];
+	}
+	st->txn_mask |= mask;
+
+	return 0;
+}
+
+static ssize_t si5351_store_txn(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	unsigned int freq[SI5351_MAX_CHANNELS], phase[SI5351_MAX_CHANNELS];
+	unsigned long mask;
+	unsigned int val = 0;
+	char *lines;
+	int ret;
+
+	if ((u32)this_attr->address == SI5351_TXN_COMMIT) {
+		ret = kstrtouint(buf, 10, &val);
+		if (ret)
+			return ret;
+	}
+
+	switch ((u32)this_attr->address) {
+	case SI5351_TXN_STAGE:
+		lines = kstrndup(buf, len, GFP_KERNEL);
+		if (!lines)
+			return -ENOMEM;
+		mutex_lock(&st->bus_lock);
+		ret = si5351_parse_txn(st, lines);
+		mutex_unlock(&st->bus_lock);
+		kfree(lines);
+		break;
+	case SI5351_TXN_COMMIT:
+		/* committed or not, the staged values are consumed */
+		mutex_lock(&st->bus_lock);
+		mask = st->txn_mask;
+		memcpy(freq, st->txn_freq, sizeof(freq));
+		memcpy(phase, st->txn_phase, sizeof(phase));
+		st->txn_mask = 0;
+		mutex_unlock(&st->bus_lock);
+		if (val)
+			ret = si5351_txn_commit(st, mask, freq, phase, NULL, NULL);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+
+	return ret ? ret : len;
+}
+
+/*
+ * "plan" takes "<channel>:<frequency>" entries and computes a plan for them
+ * plus every other powered up output at its current frequency. Reading it
+ * returns the plan, writing 1 to "plan_apply" commits it.
+ */
+static ssize_t si5351_show_plan(struct device *dev,
+				struct device_attribute *attr,
+				char *buf)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct si5351_plan *plan = &st->plan;
+	struct si5351_tune_solution *sol;
+	ssize_t len = 0;
+	unsigned int ch;
+
+	mutex_lock(&st->bus_lock);
+	if (!plan->valid)
+		goto out;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len, "A %u\nB %u\n",
+			 plan->fVCO[PLL_A], plan->fVCO[PLL_B]);
+	for_each_set_bit(ch, &plan->mask, SI5351_MAX_CHANNELS) {
+		sol = &plan->sol[ch];
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u %c %u %u %lu %lu %lu %lld\n",
+				 ch, (plan->pll[ch] == PLL_B) ? 'B' : 'A',
+				 plan->fout_target[ch], sol->fout_real,
+				 sol->a, sol->b, sol->c,
+				 (long long)sol->fout_real - plan->fout_target[ch]);
+	}
+out:
+	mutex_unlock(&st->bus_lock);
+
+	return len;
+}
+
+static int si5351_parse_plan(struct si5351_state *st, char *list, unsigned long *mask, unsigned int *fout)
+{
+	unsigned int ch, freq;
+	char *token;
+
+	while ((token = strsep(&list, " \t\n,")) != NULL) {
+		if (!*token)
+			continue;
+		if (sscanf(token, "%u:%u", &ch, &freq) != 2 ||
+		    ch >= st->chip_info->num_channels)
+			return -EINVAL;
+		if (freq < SI5351_MULTISYNTH_MIN_FREQ ||
+		    freq > ((ch >= 6) ? SI5351_MULTISYNTH67_MAX_FREQ : SI5351_MULTISYNTH_DIVBY4_FREQ))
+			return -ERANGE;
+		fout[ch] = freq;
+		*mask |= BIT(ch);
+	}
+
+	return 0;
+}
+
+static ssize_t si5351_store_plan(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	unsigned int fout[SI5351_MAX_CHANNELS];
+	unsigned long mask = 0;
+	unsigned int val, ch;
+	u8 reset = 0;
+	char *list;
+	int ret;
+
+	if ((u32)this_attr->address == SI5351_PLAN_APPLY) {
+		ret = kstrtouint(buf, 10, &val);
+		if (ret)
+			return ret;
+		if (!val)
+			return len;
+	}
+
+	si5351_lock_all(st);
+	/* output groups may have been set up since the plan was made */
+	if (st->seq_running || st->group_mask) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	switch ((u32)this_attr->address) {
+	case SI5351_PLAN:
+		list = kstrndup(buf, len, GFP_KERNEL);
+		if (!list) {
+			ret = -ENOMEM;
+			break;
+		}
+		ret = si5351_parse_plan(st, list, &mask, fout);
+		kfree(list);
+		if (ret < 0)
+			break;
+
+		/* outputs that are running keep their frequency */
+		for (ch = 0; ch < st->chip_info->num_channels; ch++) {
+			if ((mask & BIT(ch)) || !st->freq_cache[ch] ||
+			    (st->image[SI5351_CLK0_CTRL + ch] & SI5351_CLK_POWERDOWN))
+				continue;
+			fout[ch] = st->freq_cache[ch];
+			mask |= BIT(ch);
+		}
+		ret = si5351_plan_solve(st, mask, fout, &st->plan);
+		break;
+	case SI5351_PLAN_APPLY:
+		ret = si5351_plan_apply(st, &st->plan);
+		st->plan.valid = 0;
+		if (ret == 0)
+			reset = st->commit_reset;
+		break;
+	default:
+		ret = -EINVAL;
+	}
+out:
+	if (ret == 0)
+		ret = si5351_unlock_all_wait(st, reset);
+	else
+		si5351_unlock_all(st);
+
+	return ret ? ret : len;
+}
+
+static ssize_t si5351_show_sweep(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	u64 rate = 0, elapsed;
+	ssize_t len = 0;
+	unsigned int i;
+
+	mutex_lock(&st->bus_lock);
+	switch ((u32)this_attr->address) {
+	case SI5351_SWEEP_CHANNEL:
+		len = sprintf(buf, "%u\n", st->sweep_channel);
+		break;
+	case SI5351_SWEEP_START:
+		len = sprintf(buf, "%u\n", st->sweep_start);
+		break;
+	case SI5351_SWEEP_STOP:
+		len = sprintf(buf, "%u\n", st->sweep_stop);
+		break;
+	case SI5351_SWEEP_STEP:
+		len = sprintf(buf, "%u\n", st->sweep_step);
+		break;
+	case SI5351_SWEEP_LOG:
+		len = sprintf(buf, "%d\n", st->sweep_log);
+		break;
+	case SI5351_SWEEP_DWELL:
+		len = sprintf(buf, "%lld\n", ktime_to_us(st->sweep_dwell));
+		break;
+	case SI5351_SWEEP_REPEAT:
+		len = sprintf(buf, "%u\n", st->sweep_repeat);
+		break;
+	case SI5351_SWEEP_RUN:
+		len = sprintf(buf, "%d\n", st->seq_running && st->seq_mode == SI5351_SEQ_SWEEP);
+		break;
+	case SI5351_SWEEP_STATS:
+		/* steps per second over the completed intervals */
+		if (st->seq_mode == SI5351_SEQ_SWEEP && st->seq_steps > 1) {
+			elapsed = ktime_to_ns(ktime_sub(st->seq_last, st->seq_first));
+			if (elapsed)
+				rate = div64_u64((st->seq_steps - 1) * NSEC_PER_SEC, elapsed);
+		}
+		len = sprintf(buf, "%llu %u %llu %llu %lld %lld\n",
+			      st->seq_mode == SI5351_SEQ_SWEEP ? st->seq_steps : 0,
+			      st->sweep_passes,
+			      st->seq_mode == SI5351_SEQ_SWEEP ? st->seq_missed : 0,
+			      rate, st->sweep_err_last, st->sweep_err_max);
+		break;
+	case SI5351_SWEEP_ERRORS:
+		for (i = 0; i < st->sweep_num_points; i++)
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%u %d\n",
+					 st->sweep_points[i].freq,
+					 st->sweep_points[i].err);
+		break;
+	default:
+		len = -EINVAL;
+	}
+	mutex_unlock(&st->bus_lock);
+
+	return len;
+}
+
+static ssize_t si5351_store_sweep(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	/* stopping waits for the worker, which takes the locks itself */
+	if ((u32)this_attr->address == SI5351_SWEEP_RUN && !val) {
+		si5351_seq_stop(st);
+		return len;
+	}
+
+	si5351_lock_all(st);
+	if (st->seq_running) {
+		si5351_unlock_all(st);
+		return -EBUSY;
+	}
+
+	switch ((u32)this_attr->address) {
+	case SI5351_SWEEP_CHANNEL:
+		/* multisynth 6 and 7 have no fractional divider */
+		if (val >= st->chip_info->num_channels || val >= 6)
+			ret = -EINVAL;
+		else
+			st->sweep_channel = val;
+		break;
+	case SI5351_SWEEP_START:
+		st->sweep_start = val;
+		break;
+	case SI5351_SWEEP_STOP:
+		st->sweep_stop = val;
+		break;
+	case SI5351_SWEEP_STEP:
+		st->sweep_step = val;
+		break;
+	case SI5351_SWEEP_LOG:
+		st->sweep_log = !!val;
+		break;
+	case SI5351_SWEEP_DWELL:
+		if (val < SI5351_SEQ_MIN_DWELL_US)
+			ret = -EINVAL;
+		else
+			st->sweep_dwell = us_to_ktime(val);
+		break;
+	case SI5351_SWEEP_REPEAT:
+		st->sweep_repeat = val;
+		break;
+	case SI5351_SWEEP_RUN:
+		ret = si5351_sweep_prepare(st);
+		if (ret == 0)
+			ret = si5351_seq_start(st, SI5351_SEQ_SWEEP, st->sweep_dwell);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+	si5351_unlock_all(st);
+
+	return ret ? ret : len;
+}
+
+/*
+ * "vcxo_fine_ppb" shifts PLL_B, and with it every output running from it,
+ * by a signed offset in parts per billion. Si5351B only.
+ */
+static ssize_t si5351_show_vcxo(struct device *dev,
+				struct device_attribute *attr,
+				char *buf)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	int ppb;
+
+	if (!st->chip_info->vcxo)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&st->bus_lock);
+	ppb = (si5351_vcxo_feedback(st) == st->vcxo_last) ? st->vcxo_ppb : 0;
+	mutex_unlock(&st->bus_lock);
+
+	return sprintf(buf, "%d\n", ppb);
+}
+
+static ssize_t si5351_store_vcxo(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	int ppb, ret;
+
+	if (!st->chip_info->vcxo)
+		return -EOPNOTSUPP;
+
+	ret = kstrtoint(buf, 10, &ppb);
+	if (ret)
+		return ret;
+
+	mutex_lock(&st->pll_lock[PLL_B]);
+	mutex_lock(&st->bus_lock);
+	ret = si5351_vcxo_fine(st, ppb);
+	mutex_unlock(&st->bus_lock);
+	mutex_unlock(&st->pll_lock[PLL_B]);
+
+	return ret ? ret : len;
+}
+
+/*
+ * "wait_lock" makes tunes that reset a PLL return only once it has locked
+ * again, or fail with -ETIMEDOUT after "lock_timeout_us". "lock_stats" has
+ * a line per PLL: the timeouts, then the lock times as a histogram where
+ * bucket i counts locks within [2^(i-1), 2^i) us, the last one open ended.
+ */
+static ssize_t si5351_show_lock(struct device *dev,
+				struct device_attribute *attr,
+				char *buf)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	ssize_t len = 0;
+	unsigned int pll, i;
+
+	switch ((u32)this_attr->address) {
+	case SI5351_WAIT_LOCK:
+		len = sprintf(buf, "%d\n", READ_ONCE(st->wait_lock));
+		break;
+	case SI5351_LOCK_TIMEOUT:
+		len = sprintf(buf, "%u\n", READ_ONCE(st->lock_timeout_us));
+		break;
+	case SI5351_LOCK_STATS:
+		mutex_lock(&st->pll_lock[PLL_A]);
+		mutex_lock_nested(&st->pll_lock[PLL_B], SINGLE_DEPTH_NESTING);
+		for (pll = PLL_A; pll <= PLL_B; pll++) {
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%c %llu",
+					 'A' + pll, st->lock_timeouts[pll]);
+			for (i = 0; i < SI5351_LOCK_HIST_BUCKETS; i++)
+				len += scnprintf(buf + len, PAGE_SIZE - len, " %llu",
+						 st->lock_hist[pll][i]);
+			len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+		}
+		mutex_unlock(&st->pll_lock[PLL_B]);
+		mutex_unlock(&st->pll_lock[PLL_A]);
+		break;
+	default:
+		len = -EINVAL;
+	}
+
+	return len;
+}
+
+static ssize_t si5351_store_lock(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	switch ((u32)this_attr->address) {
+	case SI5351_WAIT_LOCK:
+		WRITE_ONCE(st->wait_lock, !!val);
+		break;
+	case SI5351_LOCK_TIMEOUT:
+		if (!val || val > USEC_PER_SEC)
+			return -EINVAL;
+		WRITE_ONCE(st->lock_timeout_us, val);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return len;
+}
+
+/*
+ * "output_groups" lists one group per line as "<group> <output>:<phase> ...".
+ * Writing such a line sets that group, a bare "<group>" dissolves it.
+ */
+static ssize_t si5351_show_groups(struct device *dev,
+				  struct device_attribute *attr,
+				  char *buf)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	ssize_t len = 0;
+	unsigned int group, ch;
+
+	si5351_lock_all(st);
+	for (group = 0; group < SI5351_MAX_GROUPS; group++) {
+		if (!st->groups[group].mask)
+			continue;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u", group);
+		for_each_set_bit(ch, &st->groups[group].mask, SI5351_MAX_CHANNELS)
+			len += scnprintf(buf + len, PAGE_SIZE - len, " %u:%u",
+					 ch, st->groups[group].phase[ch]);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+	si5351_unlock_all(st);
+
+	return len;
+}
+
+static int si5351_parse_group(char *list, unsigned int *group, unsigned long *mask, unsigned int *phase)
+{
+	unsigned int ch, deg;
+	char *token;
+
+	*group = SI5351_MAX_GROUPS;
+	*mask = 0;
+	while ((token = strsep(&list, " \t\n,")) != NULL) {
+		if (!*token)
+			continue;
+		if (*group == SI5351_MAX_GROUPS) {
+			if (kstrtouint(token, 10, group) || *group >= SI5351_MAX_GROUPS)
+				return -EINVAL;
+			continue;
+		}
+		if (sscanf(token, "%u:%u", &ch, &deg) != 2 ||
+		    ch >= SI5351_MAX_CHANNELS || (*mask & BIT(ch)))
+			return -EINVAL;
+		phase[ch] = deg;
+		*mask |= BIT(ch);
+	}
+
+	return (*group < SI5351_MAX_GROUPS) ? 0 : -EINVAL;
+}
+
+static ssize_t si5351_store_groups(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct si5351_state *st = iio_priv(indio_dev);
+	unsigned int group, phase[SI5351_MAX_CHANNELS];
+	unsigned long mask;
+	char *list;
+	int ret;
+
+	list = kstrndup(buf, len, GFP_KERNEL);
+	if (!list)
+		return -ENOMEM;
+	ret = si5351_parse_group(list, &group, &mask, phase);
+	kfree(list);
+	if (ret)
+		return ret;
+
+	si5351_lock_all(st);
+	ret = si5351_group_set(st, group, mask, phase);
+	si5351_unlock_all(st);
+
+	return ret ? ret : len;
+}
+
+static IIO_DEVICE_ATTR(last_tune_bytes, S_IRUGO, si5351_show_stat, NULL, SI5351_STAT_LAST_TUNE_BYTES);
+static IIO_DEVICE_ATTR(total_tune_bytes, S_IRUGO, si5351_show_stat, NULL, SI5351_STAT_TOTAL_TUNE_BYTES);
+static IIO_DEVICE_ATTR(commits, S_IRUGO, si5351_show_stat, NULL, SI5351_STAT_COMMITS);
+static IIO_DEVICE_ATTR(tune_cache_size, S_IRUGO | S_IWUSR, si5351_show_stat, si5351_store_tune_cache_size, SI5351_STAT_TUNE_CACHE_SIZE);
+static IIO_DEVICE_ATTR(tune_cache_hits, S_IRUGO, si5351_show_stat, NULL, SI5351_STAT_TUNE_CACHE_HITS);
+static IIO_DEVICE_ATTR(tune_cache_misses, S_IRUGO, si5351_show_stat, NULL, SI5351_STAT_TUNE_CACHE_MISSES);
+static IIO_DEVICE_ATTR(hop_table, S_IRUGO | S_IWUSR, si5351_show_hop, si5351_store_hop, SI5351_HOP_TABLE);
+static IIO_DEVICE_ATTR(hop_channel, S_IRUGO | S_IWUSR, si5351_show_hop, si5351_store_hop, SI5351_HOP_CHANNEL);
+static IIO_DEVICE_ATTR(hop_dwell_us, S_IRUGO | S_IWUSR, si5351_show_hop, si5351_store_hop, SI5351_HOP_DWELL);
+static IIO_DEVICE_ATTR(hop_loop, S_IRUGO | S_IWUSR, si5351_show_hop, si5351_store_hop, SI5351_HOP_LOOP);
+static IIO_DEVICE_ATTR(hop_run, S_IRUGO | S_IWUSR, si5351_show_hop, si5351_store_hop, SI5351_HOP_RUN);
+static IIO_DEVICE_ATTR(hop_stats, S_IRUGO, si5351_show_hop, NULL, SI5351_HOP_STATS);
+static IIO_DEVICE_ATTR(async_mode, S_IRUGO | S_IWUSR, si5351_show_async, si5351_store_async_mode, SI5351_ASYNC_MODE);
+static IIO_DEVICE_ATTR(async_generation, S_IRUGO, si5351_show_async, NULL, SI5351_ASYNC_GENERATION);
+static IIO_DEVICE_ATTR(async_stats, S_IRUGO, si5351_show_async, NULL, SI5351_ASYNC_STATS);
+static IIO_DEVICE_ATTR(txn_stage, S_IRUGO | S_IWUSR, si5351_show_txn, si5351_store_txn, SI5351_TXN_STAGE);
+static IIO_DEVICE_ATTR(txn_commit, S_IWUSR, NULL, si5351_store_txn, SI5351_TXN_COMMIT);
+static IIO_DEVICE_ATTR(plan, S_IRUGO | S_IWUSR, si5351_show_plan, si5351_store_plan, SI5351_PLAN);
+static IIO_DEVICE_ATTR(plan_apply, S_IWUSR, NULL, si5351_store_plan, SI5351_PLAN_APPLY);
+static IIO_DEVICE_ATTR(sweep_channel, S_IRUGO | S_IWUSR, si5351_show_sweep, si5351_store_sweep, SI5351_SWEEP_CHANNEL);
+static IIO_DEVICE_ATTR(sweep_start, S_IRUGO | S_IWUSR, si5351_show_sweep, si5351_store_sweep, SI5351_SWEEP_START);
+static IIO_DEVICE_ATTR(sweep_stop, S_IRUGO | S_IWUSR, si5351_show_sweep, si5351_store_sweep, SI5351_SWEEP_STOP);
+static IIO_DEVICE_ATTR(sweep_step, S_IRUGO | S_IWUSR, si5351_show_sweep, si5351_store_sweep, SI5351_SWEEP_STEP);
+static IIO_DEVICE_ATTR(sweep_log, S_IRUGO | S_IWUSR, si5351_show_sweep, si5351_store_sweep, SI5351_SWEEP_LOG);
+static IIO_DEVICE_ATTR(sweep_dwell_us, S_IRUGO | S_IWUSR, si5351_show_sweep, si5351_store_sweep, SI5351_SWEEP_DWELL);
+static IIO_DEVICE_ATTR(sweep_repeat, S_IRUGO | S_IWUSR, si5351_show_sweep, si5351_store_sweep, SI5351_SWEEP_REPEAT);
+static IIO_DEVICE_ATTR(sweep_run, S_IRUGO | S_IWUSR, si5351_show_sweep, si5351_store_sweep, SI5351_SWEEP_RUN);
+static IIO_DEVICE_ATTR(sweep_stats, S_IRUGO, si5351_show_sweep, NULL, SI5351_SWEEP_STATS);
+static IIO_DEVICE_ATTR(sweep_errors, S_IRUGO, si5351_show_sweep, NULL, SI5351_SWEEP_ERRORS);
+static IIO_DEVICE_ATTR(output_groups, S_IRUGO | S_IWUSR, si5351_show_groups, si5351_store_groups, SI5351_OUTPUT_GROUPS);
+static IIO_DEVICE_ATTR(vcxo_fine_ppb, S_IRUGO | S_IWUSR, si5351_show_vcxo, si5351_store_vcxo, SI5351_VCXO_FINE);
+static IIO_DEVICE_ATTR(wait_lock, S_IRUGO | S_IWUSR, si5351_show_lock, si5351_store_lock, SI5351_WAIT_LOCK);
+static IIO_DEVICE_ATTR(lock_timeout_us, S_IRUGO | S_IWUSR, si5351_show_lock, si5351_store_lock, SI5351_LOCK_TIMEOUT);
+static IIO_DEVICE_ATTR(lock_stats, S_IRUGO, si5351_show_lock, NULL, SI5351_LOCK_STATS);
+
+static struct attribute *si5351_attributes[] = {
+	&iio_dev_attr_last_tune_bytes.dev_attr.attr,
+	&iio_dev_attr_total_tune_bytes.dev_attr.attr,
+	&iio_dev_attr_commits.dev_attr.attr,
+	&iio_dev_attr_tune_cache_size.dev_attr.attr,
+	&iio_dev_attr_tune_cache_hits.dev_attr.attr,
+	&iio_dev_attr_tune_cache_misses.dev_attr.attr,
+	&iio_dev_attr_hop_table.dev_attr.attr,
+	&iio_dev_attr_hop_channel.dev_attr.attr,
+	&iio_dev_attr_hop_dwell_us.dev_attr.attr,
+	&iio_dev_attr_hop_loop.dev_attr.attr,
+	&iio_dev_attr_hop_run.dev_attr.attr,
+	&iio_dev_attr_hop_stats.dev_attr.attr,
+	&iio_dev_attr_async_mode.dev_attr.attr,
+	&iio_dev_attr_async_generation.dev_attr.attr,
+	&iio_dev_attr_async_stats.dev_attr.attr,
+	&iio_dev_attr_txn_stage.dev_attr.attr,
+	&iio_dev_attr_txn_commit.dev_attr.attr,
+	&iio_dev_attr_plan.dev_attr.attr,
+	&iio_dev_attr_plan_apply.dev_attr.attr,
+	&iio_dev_attr_sweep_channel.dev_attr.attr,
+	&iio_dev_attr_sweep_start.dev_attr.attr,
+	&iio_dev_attr_sweep_stop.dev_attr.attr,
+	&iio_dev_attr_sweep_step.dev_attr.attr,
+	&iio_dev_attr_sweep_log.dev_attr.attr,
+	&iio_dev_attr_sweep_dwell_us.dev_attr.attr,
+	&iio_dev_attr_sweep_repeat.dev_attr.attr,
+	&iio_dev_attr_sweep_run.dev_attr.attr,
+	&iio_dev_attr_sweep_stats.dev_attr.attr,
+	&iio_dev_attr_sweep_errors.dev_attr.attr,
+	&iio_dev_attr_output_groups.dev_attr.attr,
+	&iio_dev_attr_vcxo_fine_ppb.dev_attr.attr,
+	&iio_dev_attr_wait_lock.dev_attr.attr,
+	&iio_dev_attr_lock_timeout_us.dev_attr.attr,
+	&iio_dev_attr_lock_stats.dev_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group si5351_attribute_group = {
+	.attrs = si5351_attributes,
+};
+
+static const struct iio_info si5351_info = {
+	.attrs = &si5351_attribute_group,
+};
+
+static const char * const si5351_retune_modes[] = {
+	[SI5351_RETUNE_PHASE_ALIGNED] = "phase-aligned",
+	[SI5351_RETUNE_FAST] = "fast",
+};
+
+static int si5351_get_retune_mode(struct iio_dev *indio_dev,
+				  const struct iio_chan_spec *chan)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+
+	return st->retune_mode;
+}
+
+static int si5351_set_retune_mode(struct iio_dev *indio_dev,
+				  const struct iio_chan_spec *chan,
+				  unsigned int mode)
+{
+	struct si5351_state *st = iio_priv(indio_dev);
+
+	mutex_lock(&st->bus_lock);
+	st->retune_mode = mode;
+	mutex_unlock(&st->bus_lock);
+
+	return 0;
+}
+
+static const struct iio_enum si5351_retune_mode_enum = {
+	.items = si5351_retune_modes,
+	.num_items = ARRAY_SIZE(si5351_retune_modes),
+	.get = si5351_get_retune_mode,
+	.set = si5351_set_retune_mode,
+};
+
+static const struct iio_chan_spec_ext_info si5351_ext_info[] = {
+{ \
+	.name = "frequency", \
+	.read = si5351_read_ext, \
+	.write = si5351_write_ext, \
+	.private = SI5351_FREQ, \
+	.shared = IIO_SEPARATE, \
+},
+{ \
+	.name = "phase", \
+	.read = si5351_read_ext, \
+	.write = si5351_write_ext, \
+	.private = SI5351_PHASE, \
+	.shared = IIO_SEPARATE, \
+},
+{
+	.name = "query",
+	.read = si5351_read_query,
+	.write = si5351_write_query,
+	.shared = IIO_SEPARATE,
+},
+{
+	.name = "hop_frequency",
+	.read = si5351_read_hop,
+	.write = si5351_write_hop,
+	.private = SI5351_HOP_FREQ,
+	.shared = IIO_SEPARATE,
+},
+{
+	.name = "hop_commit",
+	.read = si5351_read_hop,
+	.write = si5351_write_hop,
+	.private = SI5351_HOP_COMMIT,
+	.shared = IIO_SEPARATE,
+},
+{
+	.name = "frequency_exact",
+	.read = si5351_read_exact,
+	.write = si5351_write_exact,
+	.shared = IIO_SEPARATE,
+},
+{
+	.name = "fine_tune",
+	.read = si5351_read_fine,
+	.write = si5351_write_fine,
+	.private = SI5351_FINE_TUNE,
+	.shared = IIO_SEPARATE,
+},
+{
+	.name = "tune_path",
+	.read = si5351_read_fine,
+	.private = SI5351_TUNE_PATH,
+	.shared = IIO_SEPARATE,
+},
+	IIO_ENUM("retune_mode", IIO_SHARED_BY_ALL, &si5351_retune_mode_enum),
+{
+	.name = "retune_mode_available",
+	.shared = IIO_SHARED_BY_ALL,
+	.read = iio_enum_available_read,
+	.private = (uintptr_t)&si5351_retune_mode_enum,
+},
+	{ },
+};
+
+#define SI5351_CHANNEL(chan, _ext_info) {		\
+	.type = IIO_VOLTAGE,					\
+	.indexed = 1,						\
+	.output = 1,						\
+	.channel = (chan),					\
+	.info_mask_separate = 0,				\
+	.ext_info = (_ext_info),				\
+	.scan_index = (chan),					\
+	.scan_type = {						\
+		.sign = 'u',					\
+		.realbits = 32,					\
+		.storagebits = 32,				\
+		.endianness = IIO_CPU,				\
+	},							\
+}
+
+#define DECLARE_SI5351C_CHANNELS(name, ext_info) \
+const struct iio_chan_spec name[] = { \
+	SI5351_CHANNEL(0, ext_info), \
+	SI5351_CHANNEL(1, ext_info), \
+	SI5351_CHANNEL(2, ext_info), \
+	SI5351_CHANNEL(3, ext_info), \
+	SI5351_CHANNEL(4, ext_info), \
+	SI5351_CHANNEL(5, ext_info), \
+	SI5351_CHANNEL(6, ext_info), \
+	SI5351_CHANNEL(7, ext_info), \
+}
+
+#define DECLARE_SI5351A_CHANNELS(name, ext_info) \
+const struct iio_chan_spec name[] = { \
+	SI5351_CHANNEL(0, ext_info), \
+	SI5351_CHANNEL(1, ext_info), \
+	SI5351_CHANNEL(2, ext_info), \
+}
+
+
+static DECLARE_SI5351A_CHANNELS(si5351a_channels, si5351_ext_info);
+static DECLARE_SI5351C_CHANNELS(si5351c_channels, si5351_ext_info);
+
+static const struct si5351_chip_info si5351_chip_info_tbl[] = {
+	[ID_SI5351A] = {
+		.channels = si5351a_channels,
+		.num_channels = 3,
+	},
+	[ID_SI5351B] = {
+		.channels = si5351c_channels,
+		.num_channels = 8,
+		.vcxo = 1,
+	},
+	[ID_SI5351C] = {
+		.channels = si5351c_channels,
+		.num_channels = 8,
+	},
+};
+
+/*
+ * Register shadow: the complete register file is read once at probe time and
+ * every write below goes through these helpers, so read-modify-write
+ * sequences are computed from st->regs and a retune only puts writes on the
+ * bus. Registers that change behind our back (status, self-clearing reset)
+ * are never cached.
+ */
+static inline bool si5351_reg_volatile(unsigned int reg)
+{
+	switch (reg) {
+	case SI5351_DEVICE_STATUS:
+	case SI5351_INTERRUPT_STATUS:
+	case SI5351_PLL_RESET:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* count bus traffic: one transfer of @bytes after the address byte */
+static void si5351_stats_i2c(struct si5351_state *st, bool write, unsigned int bytes)
+{
+	spin_lock(&st->stats_lock);
+	if (write) {
+		st->stats.write_xfers++;
+		st->stats.write_bytes += bytes;
+	} else {
+		st->stats.read_xfers++;
+		st->stats.read_bytes += bytes;
+	}
+	spin_unlock(&st->stats_lock);
+}
+
+/* add the time since @start to a log2(ns) histogram of st->stats */
+static void si5351_stats_time(struct si5351_state *st, unsigned long long *hist, ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	unsigned int bucket = min_t(unsigned int, fls64(ns), SI5351_STATS_HIST_BUCKETS - 1);
+
+	spin_lock(&st->stats_lock);
+	hist[bucket]++;
+	spin_unlock(&st->stats_lock);
+}
+
+/*
+ * Bus access. All traffic to the chip goes through st->bus: si5351_i2c_bus
+ * sends a commit as one i2c_transfer(), si5351_smbus_bus falls back to
+ * SMBus writes for adapters without plain I2C. Both read with SMBus calls.
+ */
+static int si5351_smbus_read(struct si5351_state *st, unsigned int reg, u8 *val, unsigned int len)
+{
+	struct i2c_client *i2c = to_i2c_client(st->dev);
+	unsigned int n;
+	int ret;
+
+	if (len == 1 || !i2c_check_functionality(i2c->adapter, I2C_FUNC_SMBUS_READ_I2C_BLOCK)) {
+		for (; len; reg++, val++, len--) {
+			ret = i2c_smbus_read_byte_data(i2c, reg);
+			si5351_stats_i2c(st, false, 1);
+			if (ret < 0)
+				return ret;
+			*val = ret;
+		}
+		return 0;
+	}
+
+	for (; len; reg += n, val += n, len -= n) {
+		n = min_t(unsigned int, len, I2C_SMBUS_BLOCK_MAX);
+		ret = i2c_smbus_read_i2c_block_data(i2c, reg, n, val);
+		si5351_stats_i2c(st, false, n);
+		if (ret < 0)
+			return ret;
+		if (ret != n)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+/* send the messages staged by si5351_commit() as a single transfer */
+static int si5351_i2c_write(struct si5351_state *st)
+{
+	struct i2c_client *i2c = to_i2c_client(st->dev);
+	int ret;
+
+	ret = i2c_transfer(i2c->adapter, st->msgs, st->num_msgs);
+	spin_lock(&st->stats_lock);
+	st->stats.write_xfers += st->num_msgs;
+	st->stats.write_bytes += st->xfer_len;
+	spin_unlock(&st->stats_lock);
+	if (ret < 0)
+		return ret;
+
+	return (ret == st->num_msgs) ? 0 : -EIO;
+}
+
+static int si5351_reg_fill_shadow(struct si5351_state *st)
+{
+	/* the transfer buffer is idle here, a failed read leaves the shadow alone */
+	u8 *buf = st->data.xfer;
+	int ret;
+
+	ret = st->bus->read(st, 0, buf, SI5351_REG_COUNT);
+	if (ret < 0)
+		return ret;
+
+	memcpy(st->regs, buf, SI5351_REG_COUNT);
+	memcpy(st->image, buf, SI5351_REG_COUNT);
+	st->pll_reset = 0;
+	st->shadow_stale = false;
+
+	return 0;
+}
+
+/*
+ * Register writes are staged into st->image and sent by si5351_commit(),
+ * which compares the image with the shadow and only puts the bytes that
+ * actually changed on the bus.
+ */
+static void si5351_stage_write(struct si5351_state *st, unsigned int reg, u8 val)
+{
+	st->image[reg] = val;
+}
+
+static void si5351_stage_update_bits(struct si5351_state *st, unsigned int reg, u8 mask, u8 val)
+{
+	st->image[reg] = (st->image[reg] & ~mask) | (val & mask);
+}
+
+static void si5351_stage_bulk(struct si5351_state *st, unsigned int reg, unsigned int len, const u8 *buf)
+{
+	memcpy(&st->image[reg], buf, len);
+}
+
+static void si5351_stage_pll_reset(struct si5351_state *st, unsigned int pll)
+{
+	st->pll_reset |= (pll == PLL_A) ? SI5351_PLL_RESET_A : SI5351_PLL_RESET_B;
+}
+
+/* true if the staged image changes the feedback divider of the PLL */
+static bool si5351_stage_pll_changed(struct si5351_state *st, unsigned int pll)
+{
+	unsigned int start_reg = (pll == PLL_A) ? SI5351_PLLA_PARAMETERS : SI5351_PLLB_PARAMETERS;
+
+	if (memcmp(&st->image[start_reg], &st->regs[start_reg], SI5351_PARAMETERS_LENGTH))
+		return true;
+	/* plla/pllb integer mode is in clk6/clk7 ctrl registers */
+	return (st->image[SI5351_CLK6_CTRL + pll] ^ st->regs[SI5351_CLK6_CTRL + pll]) & SI5351_CLK_INTEGER_MODE;
+}
+
+/* a register the next commit has to send, every one while the shadow is stale */
+static inline bool si5351_commit_dirty(struct si5351_state *st, unsigned int reg)
+{
+	return st->shadow_stale || st->image[reg] != st->regs[reg];
+}
+
+/* registers that are never part of a run */
+static inline bool si5351_commit_deferred(unsigned int reg)
+{
+	return si5351_reg_volatile(reg) || reg == SI5351_OUTPUT_ENABLE_CTRL;
+}
+
+/* append one register run as a write message to the pending transfer */
+static void si5351_commit_add(struct si5351_state *st, unsigned int reg, const u8 *val, unsigned int len)
+{
+	struct i2c_msg *msg = &st->msgs[st->num_msgs++];
+	u8 *buf = &st->data.xfer[st->xfer_len];
+
+	buf[0] = reg;
+	memcpy(&buf[1], val, len);
+
+	msg->addr = to_i2c_client(st->dev)->addr;
+	msg->flags = 0;
+	msg->len = len + 1;
+	msg->buf = buf;
+
+	st->xfer_len += len + 1;
+	st->commit_bytes += len;
+}
+
+/* fallback for adapters without plain I2C support: one SMBus call per chunk */
+static int si5351_smbus_write(struct si5351_state *st)
+{
+	struct i2c_client *i2c = to_i2c_client(st->dev);
+	unsigned int i, reg, len, n;
+	u8 *val;
+	int ret;
+
+	for (i = 0; i < st->num_msgs; i++) {
+		reg = st->msgs[i].buf[0];
+		val = &st->msgs[i].buf[1];
+		len = st->msgs[i].len - 1;
+		while (len) {
+			n = min_t(unsigned int, len, I2C_SMBUS_BLOCK_MAX);
+			if (n == 1)
+				ret = i2c_smbus_write_byte_data(i2c, reg, *val);
+			else
+				ret = i2c_smbus_write_i2c_block_data(i2c, reg, n, val);
+			si5351_stats_i2c(st, true, n + 1);
+			if (ret < 0)
+				return ret;
+			reg += n;
+			val += n;
+			len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static const struct si5351_bus_ops si5351_i2c_bus = {
+	.read = si5351_smbus_read,
+	.write = si5351_i2c_write,
+};
+
+static const struct si5351_bus_ops si5351_smbus_bus = {
+	.read = si5351_smbus_read,
+	.write = si5351_smbus_write,
+};
+
+/*
+ * Send every contiguous run of registers whose staged value differs from the
+ * shadow, in ascending address order. Runs separated by no more than
+ * SI5351_COMMIT_MERGE_GAP unchanged bytes are sent as one, which is cheaper
+ * than paying the address and register bytes of another message. The
+ * output enable register goes out after the PLL reset so outputs are only
+ * switched on once they are configured.
+ *
+ * All runs are sent as the messages of a single i2c_transfer(), so the
+ * adapter lock is taken once and no other traffic on the bus can slip in
+ * between the parts of a retune.
+ */
+static int si5351_commit(struct si5351_state *st)
+{
+	unsigned int reg, start, end, i;
+	ktime_t begin;
+	int ret = 0;
+
+	st->commit_bytes = 0;
+	st->num_msgs = 0;
+	st->xfer_len = 0;
+
+	for (reg = 0; reg < SI5351_REG_COUNT; ) {
+		if (si5351_commit_deferred(reg) || !si5351_commit_dirty(st, reg)) {
+			reg++;
+			continue;
+		}
+
+		start = reg;
+		end = reg + 1;
+		for (reg = end; reg < SI5351_REG_COUNT && reg <= end + SI5351_COMMIT_MERGE_GAP; reg++) {
+			if (si5351_commit_deferred(reg))
+				break;
+			if (si5351_commit_dirty(st, reg))
+				end = reg + 1;
+		}
+		reg = end;
+
+		si5351_commit_add(st, start, &st->image[start], end - start);
+	}
+
+	if (st->pll_reset)
+		si5351_commit_add(st, SI5351_PLL_RESET, &st->pll_reset, 1);
+
+	if (si5351_commit_dirty(st, SI5351_OUTPUT_ENABLE_CTRL))
+		si5351_commit_add(st, SI5351_OUTPUT_ENABLE_CTRL, &st->image[SI5351_OUTPUT_ENABLE_CTRL], 1);
+
+	if (trace_si5351_reg_burst_enabled()) {
+		for (i = 0; i < st->num_msgs; i++)
+			trace_si5351_reg_burst(st->dev, st->msgs[i].buf[0], &st->msgs[i].buf[1],
+					       st->msgs[i].len - 1);
+	}
+
+	if (st->num_msgs) {
+		begin = ktime_get();
+		ret = st->bus->write(st);
+		si5351_stats_time(st, st->stats.commit_hist, begin);
+	}
+
+	if (ret < 0) {
+		/* we don't know how far the transfer got, read the chip back */
+		dev_err(st->dev, "si5351-iio: register commit failed: error %d\n", ret);
+		if (si5351_reg_fill_shadow(st) < 0) {
+			/*
+			 * Nor what the chip holds now. Drop the staged tune
+			 * like a successful read would, and have the next
+			 * commit send every register instead of a diff.
+			 */
+			dev_err(st->dev, "si5351-iio: register readback failed, next commit writes all registers\n");
+			memcpy(st->image, st->regs, SI5351_REG_COUNT);
+			st->shadow_stale = true;
+		}
+	} else {
+		memcpy(st->regs, st->image, SI5351_REG_COUNT);
+		st->shadow_stale = false;
+	}
+	st->commit_reset = (ret < 0) ? 0 : st->pll_reset;
+	st->pll_reset = 0;
+	if (st->commit_reset) {
+		trace_si5351_pll_reset(st->dev, st->commit_reset);
+		spin_lock(&st->stats_lock);
+		if (st->commit_reset & SI5351_PLL_RESET_A)
+			st->stats.pll_resets[PLL_A]++;
+		if (st->commit_reset & SI5351_PLL_RESET_B)
+			st->stats.pll_resets[PLL_B]++;
+		spin_unlock(&st->stats_lock);
+	}
+	st->last_tune_bytes = st->commit_bytes;
+	st->total_tune_bytes += st->commit_bytes;
+	st->commits++;
+
+	return ret;
+}
+
+/*
+ * Wait for the PLLs in @reset (SI5351_PLL_RESET bits, usually the
+ * commit_reset of the commit just sent) to lock again, if wait_lock is set.
+ * The interrupt pin only signals loss of lock, so the LOL bits of the
+ * device status register are polled until they clear or lock_timeout_us
+ * has passed. The time to lock goes into the PLL's histogram. Called with
+ * the pll_lock of each PLL in @reset held; the tune paths drop the bus lock
+ * first so the other PLL domain is not held up.
+ */
+static int si5351_wait_lock(struct si5351_state *st, u8 reset)
+{
+	unsigned int pll, bucket, pending = 0;
+	ktime_t start;
+	s64 us;
+	u8 status;
+	int ret;
+
+	if (!READ_ONCE(st->wait_lock))
+		return 0;
+	if (reset & SI5351_PLL_RESET_A)
+		pending |= BIT(PLL_A);
+	if (reset & SI5351_PLL_RESET_B)
+		pending |= BIT(PLL_B);
+
+	start = ktime_get();
+	while (pending) {
+		ret = st->bus->read(st, SI5351_DEVICE_STATUS, &status, 1);
+		if (ret < 0)
+			return ret;
+		us = ktime_us_delta(ktime_get(), start);
+
+		for (pll = PLL_A; pll <= PLL_B; pll++) {
+			if (!(pending & BIT(pll)) ||
+			    (status & ((pll == PLL_A) ? SI5351_STATUS_LOL_A : SI5351_STATUS_LOL_B)))
+				continue;
+			bucket = min_t(unsigned int, fls64(us), SI5351_LOCK_HIST_BUCKETS - 1);
+			st->lock_hist[pll][bucket]++;
+			pending &= ~BIT(pll);
+			trace_si5351_pll_lock(st->dev, pll, us, true);
+		}
+		if (!pending)
+			break;
+
+		if (us >= READ_ONCE(st->lock_timeout_us)) {
+			for (pll = PLL_A; pll <= PLL_B; pll++) {
+				if (!(pending & BIT(pll)))
+					continue;
+				st->lock_timeouts[pll]++;
+				trace_si5351_pll_lock(st->dev, pll, us, false);
+			}
+			dev_dbg(st->dev, "si5351-iio: PLL lock timeout, status 0x%02x\n", status);
+			return -ETIMEDOUT;
+		}
+		usleep_range(SI5351_LOCK_POLL_US, 2 * SI5351_LOCK_POLL_US);
+	}
+
+	return 0;
+}
+
+static void si5351_write_parameters(struct si5351_state *st,
+				    unsigned int start_reg, struct si5351_multisynth_parameters *params)
+{
+	u8 buf[SI5351_PARAMETERS_LENGTH];
+
+	switch (start_reg) {
+	case SI5351_CLK6_PARAMETERS:
+	case SI5351_CLK7_PARAMETERS:
+		buf[0] = params->p1 & 0xff;
+		si5351_stage_write(st, start_reg, buf[0]);
+		break;
+	default:
+		buf[0] = ((params->p3 & 0x0ff00) >> 8) & 0xff;
+		buf[1] = params->p3 & 0xff;
+		/* save rdiv and divby4 */
+		buf[2] = st->image[start_reg + 2] & ~0x03;
+		buf[2] |= ((params->p1 & 0x30000) >> 16) & 0x03;
+		buf[3] = ((params->p1 & 0x0ff00) >> 8) & 0xff;
+		buf[4] = params->p1 & 0xff;
+		buf[5] = ((params->p3 & 0xf0000) >> 12) |
+			((params->p2 & 0xf0000) >> 16);
+		buf[6] = ((params->p2 & 0x0ff00) >> 8) & 0xff;
+		buf[7] = params->p2 & 0xff;
+		si5351_stage_bulk(st, start_reg, SI5351_PARAMETERS_LENGTH, buf);
+	}
+}
+
+/* feedback divider a + b/c of a PLL, in the register format */
+static void si5351_pll_parameters(unsigned long a, unsigned long b, unsigned long c, struct si5351_multisynth_parameters *params)
+{
+	params->p3  = c;
+	params->p2  = (128 * b) % c;
+	params->p1  = 128 * a;
+	params->p1 += (128 * b / c);
+	params->p1 -= 512;
+}
+
+/*
+ * fVCO / fXTAL as a + b/c, exact when the reduced fraction fits the
+ * 20 bit fields and the closest b/c otherwise.
+ */
+static void si5351_pll_ratio(unsigned long long fVCO, unsigned int fXTAL, unsigned long *a, unsigned long *b, unsigned long *c)
+{
+	unsigned long rem, g;
+
+	*a = div_u64(fVCO, fXTAL);
+	rem = fVCO - (unsigned long long)*a * fXTAL;
+	*b = 0;
+	*c = 1;
+	if (!rem)
+		return;
+
+	g = gcd(rem, fXTAL);
+	*b = rem / g;
+	*c = fXTAL / g;
+	if (*c > SI5351_PLL_C_MAX)
+		rational_best_approximation(rem, fXTAL, SI5351_PLL_B_MAX,
+					    SI5351_PLL_C_MAX, b, c);
+}
+
+/* feedback divider for fVCO from fXTAL, returns the VCO frequency it produces */
+static unsigned int si5351_solve_pll(unsigned int fVCO, unsigned int fXTAL, struct si5351_multisynth_parameters *params, unsigned long *a_out, unsigned long *b_out, unsigned long *c_out)
+{
+	unsigned long rfrac, denom, a, b, c;
+	unsigned long long lltmp;
+
+	if (fVCO < SI5351_PLL_VCO_MIN)
+		fVCO = SI5351_PLL_VCO_MIN;
+	if (fVCO > SI5351_PLL_VCO_MAX)
+		fVCO = SI5351_PLL_VCO_MAX;
+
+	/* determine integer part of feedback equation */
+	a = fVCO / fXTAL;
+
+	if (a < SI5351_PLL_A_MIN)
+		fVCO = fXTAL * SI5351_PLL_A_MIN;
+	if (a > SI5351_PLL_A_MAX)
+		fVCO = fXTAL * SI5351_PLL_A_MAX;
+
+	/* find best approximation for b/c = fVCO mod fIN */
+	denom = 1000 * 1000;
+	lltmp = fVCO % fXTAL;
+	lltmp *= denom;
+	do_div(lltmp, fXTAL);
+	rfrac = (unsigned long)lltmp;
+
+	b = 0;
+	c = 1;
+	if (rfrac)
+		rational_best_approximation(rfrac, denom,
+				    SI5351_PLL_B_MAX, SI5351_PLL_C_MAX, &b, &c);
+
+	/* calculate parameters */
+	si5351_pll_parameters(a, b, c, params);
+
+	/* recalculate rate by fIN * (a + b/c) */
+	lltmp  = fXTAL;
+	lltmp *= b;
+	do_div(lltmp, c);
+
+	fVCO  = (unsigned long)lltmp;
+	fVCO += fXTAL * a;
+
+	*a_out = a;
+	*b_out = b;
+	*c_out = c;
+
+	return fVCO;
+}
+
+static int si5351_setup_pll(struct si5351_state *st, unsigned int pll, unsigned int fVCO, unsigned int fXTAL)
+{
+	struct si5351_multisynth_parameters params;
+	unsigned long a, b, c;
+
+		unsigned int start_reg = (pll == PLL_A) ? SI5351_PLLA_PARAMETERS : SI5351_PLLB_PARAMETERS;
+
+		fVCO = si5351_solve_pll(fVCO, fXTAL, &params, &a, &b, &c);
+
+		dev_dbg(st->dev, "si5351-iio: found a=%lu, b=%lu, c=%lu\n", a,  b,  c);
+		dev_dbg(st->dev, "si5351-iio: found p1=%lu, p2=%lu, p3=%lu\n", params.p1, params.p2, params.p3);
+
+		si5351_write_parameters(st, start_reg, &params);
+		/* plla/pllb ctrl is in clk6/clk7 ctrl registers */
+		si5351_stage_update_bits(st, SI5351_CLK6_CTRL + pll, SI5351_CLK_INTEGER_MODE,
+				       (params.p2 == 0) ? SI5351_CLK_INTEGER_MODE : 0);
+
+			/* Do a pll soft reset on the affected pll */
+		if (si5351_stage_pll_changed(st, pll))
+			si5351_stage_pll_reset(st, pll);
+		return fVCO;
+
+}
+
+/*
+ * Record the VCO frequency of @pll once it is programmed. The hop table
+ * holds register bytes compiled against the old VCO, so any change drops
+ * it and the table has to be loaded again.
+ */
+static void si5351_set_vco(struct si5351_state *st, unsigned int pll, unsigned int fVCO)
+{
+	if (st->fVCO[pll] != fVCO) {
+		st->hop_len = 0;
+		st->plan.valid = 0;
+	}
+	st->fVCO[pll] = fVCO;
+}
+
+static inline u8 si5351_msynth_params_address(int num)
+{
+	if (num > 5)
+		return SI5351_CLK6_PARAMETERS + (num - 6);
+	return SI5351_CLK0_PARAMETERS + (SI5351_PARAMETERS_LENGTH * num);
+}
+
+static void si5351_solve_msynth(struct si5351_state *st, unsigned int output, unsigned int fout_target, const unsigned int fVCO, unsigned int phase_target, struct si5351_tune_solution *sol)
+{
+	struct si5351_multisynth_parameters *params = &sol->msynth;
+	unsigned long a, b, c, phase_val;
+	unsigned long long lltmp;
+	int divby4;
+
+	/* multisync6-7 can only handle freqencies < 150MHz */
+	if (output >= 6 && fout_target > SI5351_MULTISYNTH67_MAX_FREQ)
+		fout_target = SI5351_MULTISYNTH67_MAX_FREQ;
+
+	/* multisync frequency is 1MHz .. 160MHz */
+	if (fout_target > SI5351_MULTISYNTH_MAX_FREQ)
+		fout_target = SI5351_MULTISYNTH_MAX_FREQ;
+	if (fout_target < SI5351_MULTISYNTH_MIN_FREQ)
+		fout_target = SI5351_MULTISYNTH_MIN_FREQ;
+
+	divby4 = 0;
+	if (fout_target > SI5351_MULTISYNTH_DIVBY4_FREQ)
+		divby4 = 1;
+
+	if (output >= 6) {
+		/* determine the closest integer divider */
+		a = DIV_ROUND_CLOSEST(fVCO, fout_target);
+		if (a < SI5351_MULTISYNTH_A_MIN)
+			a = SI5351_MULTISYNTH_A_MIN;
+		if (a > SI5351_MULTISYNTH67_A_MAX)
+			a = SI5351_MULTISYNTH67_A_MAX;
+
+		b = 0;
+		c = 1;
+	} else {
+		unsigned long rfrac, denom;
+
+		/* disable divby4 */
+		if (divby4) {
+			fout_target = SI5351_MULTISYNTH_DIVBY4_FREQ;
+			divby4 = 0;
+		}
+
+		/* determine integer part of divider equation */
+		a = fVCO / fout_target;
+		if (a < SI5351_MULTISYNTH_A_MIN)
+			a = SI5351_MULTISYNTH_A_MIN;
+		if (a > SI5351_MULTISYNTH_A_MAX)
+			a = SI5351_MULTISYNTH_A_MAX;
+
+		/* find best approximation for b/c = fVCO mod fOUT */
+		denom = 1000 * 1000;
+		lltmp = (fVCO) % fout_target;
+		lltmp *= denom;
+		do_div(lltmp, fout_target);
+		rfrac = (unsigned long)lltmp;
+
+		b = 0;
+		c = 1;
+		if (rfrac)
+			rational_best_approximation(rfrac, denom,
+			    SI5351_MULTISYNTH_B_MAX, SI5351_MULTISYNTH_C_MAX,
+			    &b, &c);
+	}
+	if ((b==0) && (phase_target==0))
+		params->intmode=1;
+	else
+		params->intmode=0;
+
+	/* recalculate fout_target by fOUT = fIN / (a + b/c) */
+	lltmp  = fVCO;
+	lltmp *= c;
+	do_div(lltmp, a * c + b);
+	sol->fout_real  = (unsigned int)lltmp;
+	//fout_real = f_VCO * c / (a*c + b)
+
+	/* calculate parameters */
+	if (divby4) {
+		params->p3 = 1;
+		params->p2 = 0;
+		params->p1 = 0;
+	} else if (output >= 6) {
+		params->p3 = 0;
+		params->p2 = 0;
+		params->p1 = a;
+	} else {
+		params->p3  = c;
+		params->p2  = (128 * b) % c;
+		params->p1  = 128 * a;
+		params->p1 += (128 * b / c);
+		params->p1 -= 512;
+	}
+
+	lltmp = a*c + b;
+	lltmp *= phase_target;
+	do_div(lltmp, c * 90);
+	phase_val = (unsigned long)lltmp;
+	/*
+	The formula for phase_val calculation is: phase_val = (fVCO / *fout_real) * phase_target / 90
+	
+	with fout_real = f_VCO * c / (a*c + b) from above we get
+	
+	phase_val = ((a*c + b) / c ) * phase_target / 90
+	*/
+	if (phase_val > 127)
+	{
+		dev_err(st->dev, "si5351-iio: limiting phase_val from %lu to 127\n", phase_val);
+		phase_val = 127;
+	}
+	lltmp = sol->fout_real;
+	lltmp *= phase_val;
+	lltmp *= 90;
+	do_div(lltmp, fVCO);
+	sol->phase_real = (unsigned int)lltmp;
+	/*
+	The chip implements phase shift by time shifting. The formula for the time shift is
+       	Delta_t = phase_val / (4*fVCO)
+	
+	With the general relation phase = Delta_t * fout * 360 we get
+	phase = phase_val * fout * 90 / fVCO
+	*/
+
+	if (fout_target > SI5351_MULTISYNTH_DIVBY4_FREQ)
+		divby4 = 1;
+
+	sol->a = a;
+	sol->b = b;
+	sol->c = c;
+	sol->fVCO = fVCO;
+	sol->phase_val = phase_val;
+	sol->divby4 = divby4;
+}
+
+static void si5351_stage_msynth(struct si5351_state *st, unsigned int output, unsigned int pll, unsigned int phase_target, struct si5351_tune_solution *sol)
+{
+	u8 start_reg;
+
+	start_reg = si5351_msynth_params_address(output);
+	/* write multisynth parameters */
+	si5351_write_parameters(st, start_reg, &sol->msynth);
+
+	/* enable/disable integer mode and divby4 on multisynth0-5 */
+	if (output < 6)
+	{
+		si5351_stage_update_bits(st, start_reg + 2, SI5351_OUTPUT_CLK_DIVBY4,
+				       sol->divby4 ? SI5351_OUTPUT_CLK_DIVBY4 : 0);
+		si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, SI5351_CLK_INTEGER_MODE,
+				       (sol->msynth.intmode == 1) ? SI5351_CLK_INTEGER_MODE : 0);
+		si5351_stage_write(st, SI5351_CLK0_PHASE_OFFSET + output, sol->phase_val & 0x7F);
+	}
+
+	/*
+	 * A soft reset realigns all outputs of the PLL, but also glitches them.
+	 * In fast mode it is only issued if the PLL itself changed or the
+	 * output needs a defined phase offset against its siblings.
+	 */
+	if (st->retune_mode == SI5351_RETUNE_PHASE_ALIGNED || phase_target ||
+	    (output < 6 && st->image[SI5351_CLK0_PHASE_OFFSET + output] != st->regs[SI5351_CLK0_PHASE_OFFSET + output]) ||
+	    si5351_stage_pll_changed(st, pll))
+		si5351_stage_pll_reset(st, pll);
+
+	si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, SI5351_CLK_PLL_SELECT,
+			       (pll == PLL_B) ? SI5351_CLK_PLL_SELECT : 0);
+
+	dev_dbg(st->dev, "si5351-iio: wrote CTRL byte %02x\n", st->image[SI5351_CLK0_CTRL + output]);
+}
+
+static unsigned int si5351_ctrl_msynth(struct si5351_state *st, unsigned int output, unsigned int enable, unsigned int input, unsigned int strength, unsigned int inversion)
+{
+	unsigned int bits = 0, allmask = 0;
+
+	allmask = SI5351_CLK_INPUT_MASK | SI5351_CLK_DRIVE_STRENGTH_MASK | SI5351_CLK_INVERT | SI5351_CLK_POWERDOWN;
+
+	input &= SI5351_CLK_INPUT_MASK;
+	bits |= input;
+
+	strength &= SI5351_CLK_DRIVE_STRENGTH_MASK;
+	bits |= strength;
+
+	if (inversion!=0)
+		bits |= SI5351_CLK_INVERT;
+
+	if (enable==0)
+		bits |= SI5351_CLK_POWERDOWN;
+
+	if (output < 8)
+	{
+		/* replace all masked bits */
+		si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, allmask, bits);
+		dev_dbg(st->dev, "si5351-iio: wrote CTRL byte %02x\n", st->image[SI5351_CLK0_CTRL + output]);
+
+		si5351_stage_update_bits(st, SI5351_OUTPUT_ENABLE_CTRL, 1 << output,
+				       (enable==1) ? 0 : (1 << output));
+		dev_dbg(st->dev, "si5351-iio: wrote OUTPUT ENABLE byte %02x\n", st->image[SI5351_OUTPUT_ENABLE_CTRL]);
+	}
+
+	return bits;
+}
+
+static inline unsigned int si5351_output_pll(struct si5351_state *st, unsigned int output)
+{
+	return (st->image[SI5351_CLK0_CTRL + output] & SI5351_CLK_PLL_SELECT) ? PLL_B : PLL_A;
+}
+
+/* true if an output other than @output is powered up and runs from @pll */
+static bool si5351_pll_shared(struct si5351_state *st, unsigned int pll, unsigned int output)
+{
+	unsigned int i;
+
+	for (i = 0; i < st->chip_info->num_channels; ++i) {
+		if (i == output)
+			continue;
+		if (st->image[SI5351_CLK0_CTRL + i] & SI5351_CLK_POWERDOWN)
+			continue;
+		if (si5351_output_pll(st, i) == pll)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Decode a PLL or multisynth parameter block as a + b/c, with c = 128 * P3
+ * so that the fraction is exact.
+ */
+static void si5351_decode_parameters(const u8 *reg, unsigned long *a, unsigned long *b, unsigned long *c)
+{
+	unsigned long p1, p2, p3;
+
+	p3 = (((unsigned long)reg[5] & 0xf0) << 12) | (reg[0] << 8) | reg[1];
+	p1 = (((unsigned long)reg[2] & 0x03) << 16) | (reg[3] << 8) | reg[4];
+	p2 = (((unsigned long)reg[5] & 0x0f) << 16) | (reg[6] << 8) | reg[7];
+	if (p3 == 0)
+		p3 = 1;
+
+	*a = (p1 + 512) / 128;
+	*b = ((p1 + 512) % 128) * p3 + p2;
+	*c = 128 * p3;
+}
+
+/* the divider of a multisynth in the register image as a + b/c */
+static void si5351_msynth_divider(struct si5351_state *st, unsigned int output,
+				  unsigned long *a, unsigned long *b, unsigned long *c)
+{
+	u8 *reg = &st->image[si5351_msynth_params_address(output)];
+
+	if (output >= 6) {
+		*a = reg[0];
+		*b = 0;
+		*c = 1;
+		return;
+	}
+
+	if ((reg[2] & SI5351_OUTPUT_CLK_DIVBY4) == SI5351_OUTPUT_CLK_DIVBY4) {
+		*a = 4;
+		*b = 0;
+		*c = 1;
+		return;
+	}
+
+	si5351_decode_parameters(reg, a, b, c);
+}
+
+/*
+ * VCXO fine tune on the Si5351B. PLL_B is kept at a feedback divider of
+ * n / 10^6 of the crystal frequency, so a shift of a few ppm only changes
+ * the fractional P2 field: three register bytes, no PLL reset and no
+ * multisynth work. This is the PLL_B setting, n, in those units.
+ */
+static unsigned long long si5351_vcxo_feedback(struct si5351_state *st)
+{
+	unsigned long a, b, c;
+
+	si5351_decode_parameters(&st->image[SI5351_PLLB_PARAMETERS], &a, &b, &c);
+
+	return (unsigned long long)a * SI5351_VCXO_DENOM +
+	       DIV_ROUND_CLOSEST_ULL((unsigned long long)b * SI5351_VCXO_DENOM, c);
+}
+
+/* stage PLL_B for feedback divider @n, returns the VCO frequency or -ERANGE */
+static int si5351_vcxo_stage(struct si5351_state *st, unsigned long long n)
+{
+	struct si5351_multisynth_parameters params;
+	unsigned long long fVCO;
+	unsigned long a, b;
+	u32 rem;
+
+	a = div_u64_rem(n, SI5351_VCXO_DENOM, &rem);
+	b = rem;
+	fVCO = DIV_ROUND_CLOSEST_ULL(n * st->xtal_rate, SI5351_VCXO_DENOM);
+	if (a < SI5351_PLL_A_MIN || a >= SI5351_PLL_A_MAX ||
+	    fVCO < SI5351_PLL_VCO_MIN || fVCO > SI5351_PLL_VCO_MAX)
+		return -ERANGE;
+
+	si5351_pll_parameters(a, b, SI5351_VCXO_DENOM, &params);
+	si5351_write_parameters(st, SI5351_PLLB_PARAMETERS, &params);
+	/* stay in fractional mode, b may pass through 0 */
+	si5351_stage_update_bits(st, SI5351_CLK6_CTRL + PLL_B, SI5351_CLK_INTEGER_MODE, 0);
+
+	return (int)fVCO;
+}
+
+/*
+ * Move PLL_B by @ppb parts per billion from where fine tuning started.
+ * Anything else retuning PLL_B meanwhile starts over from the new setting.
+ * Called with the PLL_B and bus locks held.
+ */
+static int si5351_vcxo_fine(struct si5351_state *st, int ppb)
+{
+	unsigned long long n, lltmp;
+	unsigned long a, b, c;
+	unsigned int output;
+	int fVCO, ret;
+
+	if (st->hop_owner[PLL_B])
+		return -EBUSY;
+
+	n = si5351_vcxo_feedback(st);
+	if (n != st->vcxo_last) {
+		st->vcxo_base = n;
+		st->vcxo_ppb = 0;
+	}
+
+	n = st->vcxo_base + div_s64((s64)st->vcxo_base * ppb, 1000000000);
+	fVCO = si5351_vcxo_stage(st, n);
+	if (fVCO < 0)
+		return fVCO;
+
+	ret = si5351_commit(st);
+	if (ret < 0)
+		return ret;
+
+	si5351_set_vco(st, PLL_B, fVCO);
+	st->vcxo_last = n;
+	st->vcxo_ppb = ppb;
+
+	/* every output on PLL_B moved along with it */
+	for (output = 0; output < st->chip_info->num_channels; output++) {
+		if (si5351_output_pll(st, output) != PLL_B || !st->freq_cache[output])
+			continue;
+		si5351_msynth_divider(st, output, &a, &b, &c);
+		lltmp = (unsigned long long)fVCO * c;
+		lltmp = DIV_ROUND_CLOSEST_ULL(lltmp, a * c + b);
+		si5351_update_caches(st, output, (unsigned int)lltmp, st->phase_cache[output]);
+	}
+
+	dev_dbg(st->dev, "si5351-iio: VCXO fine tune %d ppb, n=%llu, fVCO=%d\n", ppb, n, fVCO);
+
+	return 0;
+}
+
+/*
+ * On the Si5351B all outputs start on PLL_B, set up for the fine tune at
+ * 32 times the crystal frequency. The optional "vcxo-pull-range-ppm" sets
+ * the pull range of the analog VCXO control input. Staged only, the probe
+ * commits it together with PLL_A.
+ */
+static void si5351_vcxo_setup(struct si5351_state *st, struct device_node *np)
+{
+	unsigned long long param;
+	unsigned int output;
+	u32 apr = 0;
+	int fVCO;
+
+	st->vcxo_base = 32ULL * SI5351_VCXO_DENOM;
+	fVCO = si5351_vcxo_stage(st, st->vcxo_base);
+	if (fVCO < 0) {
+		dev_err(st->dev, "no VCXO setting for xtal freq %u\n", st->xtal_rate);
+		return;
+	}
+	si5351_set_vco(st, PLL_B, fVCO);
+	st->vcxo_last = st->vcxo_base;
+	si5351_stage_pll_reset(st, PLL_B);
+
+	for (output = 0; output < st->chip_info->num_channels; output++)
+		si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, SI5351_CLK_PLL_SELECT, SI5351_CLK_PLL_SELECT);
+
+	if (IS_ENABLED(CONFIG_OF) && np)
+		of_property_read_u32(np, "vcxo-pull-range-ppm", &apr);
+	if (!apr)
+		return;
+
+	/* VCXO_Param = 1.03 * (128 a + b / 10^6) * APR, with b = 0 here */
+	param = DIV_ROUND_CLOSEST_ULL(103ULL * 128 * apr * st->vcxo_base, 100ULL * SI5351_VCXO_DENOM);
+	si5351_stage_write(st, SI5351_VXCO_PARAMETERS_LOW, param & 0xff);
+	si5351_stage_write(st, SI5351_VXCO_PARAMETERS_MID, (param >> 8) & 0xff);
+	si5351_stage_write(st, SI5351_VXCO_PARAMETERS_HIGH, (param >> 16) & 0x3f);
+}
+
+/*
+ * Program the idle @pll for @output's next frequency. Called with all locks
+ * held; the caller waits for the PLL in st->commit_reset to lock once it
+ * has dropped the bus lock.
+ */
+static int si5351_prepare_hop(struct si5351_state *st, unsigned int output, unsigned int pll, unsigned int fout_target)
+{
+	unsigned long a, b, c;
+	unsigned long long lltmp;
+	unsigned int fVCO;
+	int ret;
+
+	if (st->group_mask)
+		return -EBUSY;
+	if (si5351_pll_shared(st, pll, output) ||
+	    (st->hop_owner[pll] && st->hop_owner[pll] != output + 1))
+		return -EBUSY;
+
+	/* fVCO = fout * (a + b/c) with the divider the output already uses */
+	si5351_msynth_divider(st, output, &a, &b, &c);
+	lltmp = fout_target;
+	lltmp *= b;
+	do_div(lltmp, c);
+	lltmp += (unsigned long long)fout_target * a;
+	if (lltmp < SI5351_PLL_VCO_MIN || lltmp > SI5351_PLL_VCO_MAX)
+		return -ERANGE;
+
+	fVCO = si5351_setup_pll(st, pll, (unsigned int)lltmp, st->xtal_rate);
+	/* the idle PLL feeds nothing, so it can always be reset */
+	si5351_stage_pll_reset(st, pll);
+	ret = si5351_commit(st);
+	if (ret < 0)
+		return ret;
+
+	si5351_set_vco(st, pll, fVCO);
+	st->hop_owner[pll] = output + 1;
+	lltmp = fVCO;
+	lltmp *= c;
+	do_div(lltmp, a * c + b);
+	st->hop_freq[output] = (unsigned int)lltmp;
+
+	dev_dbg(st->dev, "si5351-iio: hop on output %u prepared on PLL %u, fVCO=%u, fout=%u\n", output, pll, fVCO, st->hop_freq[output]);
+
+	return 0;
+}
+
+/*
+ * Quadrature: both outputs divide the VCO by the same even integer d, and
+ * output 1 is delayed by d quarter VCO periods, which is 90 degrees. The
+ * phase offset register holds at most 127, so 6 <= d <= 126. Every even d
+ * that puts f * d inside the VCO range is a candidate (at most about 20),
+ * the PLL fraction for each is computed directly and the first exact one,
+ * or else the closest, is used. Returns -ERANGE if no d fits.
+ */
+static int si5351_solve_quad(struct si5351_state *st, unsigned int fXTAL, unsigned int fout_target, struct si5351_tune_solution *sol)
+{
+	struct si5351_multisynth_parameters *pll_params = &sol->pll;
+	struct si5351_multisynth_parameters *msynth_params = &sol->msynth;
+	unsigned long a, b, c, d, dmin, dmax;
+	unsigned long best_a = 0, best_b = 0, best_c = 1, best_d = 0;
+	unsigned long long lltmp, fVCO, target, err, best_err = 0;
+
+	if (!fout_target)
+		return -ERANGE;
+
+	dmin = DIV_ROUND_UP(SI5351_PLL_VCO_MIN, fout_target);
+	dmin = max_t(unsigned long, round_up(dmin, 2), SI5351_MULTISYNTH_A_MIN);
+	dmax = min_t(unsigned long, SI5351_PLL_VCO_MAX / fout_target, 126);
+
+	for (d = dmin; d <= dmax; d += 2) {
+		target = (unsigned long long)fout_target * d;
+		si5351_pll_ratio(target, fXTAL, &a, &b, &c);
+		if (a < SI5351_PLL_A_MIN || a > SI5351_PLL_A_MAX)
+			continue;
+
+		/*
+		 * c * VCO error in Hz, so the output error is err / (c * d).
+		 * Candidates are compared cross-multiplied, err < xtal and
+		 * c * d < 2^27 keep the products well inside 64 bits.
+		 */
+		fVCO = (unsigned long long)fXTAL * (a * c + b);
+		lltmp = target * c;
+		err = (fVCO > lltmp) ? fVCO - lltmp : lltmp - fVCO;
+		if (best_d == 0 || err * best_c * best_d < best_err * c * d) {
+			best_err = err;
+			best_a = a;
+			best_b = b;
+			best_c = c;
+			best_d = d;
+		}
+		if (!err)
+			break;
+	}
+
+	if (!best_d) {
+		dev_dbg(st->dev, "si5351-iio: no quadrature solution for %u Hz\n", fout_target);
+		return -ERANGE;
+	}
+
+	a = best_a;
+	b = best_b;
+	c = best_c;
+	d = best_d;
+
+	/* calculate parameters */
+	si5351_pll_parameters(a, b, c, pll_params);
+
+	/* fVCO = fIN * (a + b/c), fOUT = fVCO / d, both rounded to Hz */
+	fVCO = (unsigned long long)fXTAL * (a * c + b);
+	sol->fout_real = (unsigned int)DIV_ROUND_CLOSEST_ULL(fVCO, (unsigned long long)c * d);
+	fVCO = DIV_ROUND_CLOSEST_ULL(fVCO, c);
+
+	/* calculate parameters */
+	msynth_params->p3  = 1;
+	msynth_params->p2  = 0;
+	msynth_params->p1  = 128 * d;
+	msynth_params->p1 -= 512;
+	msynth_params->intmode = 0;
+
+	sol->phase_real = 90;
+	sol->a = d;
+	sol->b = 0;
+	sol->c = 1;
+	sol->fVCO = (unsigned int)fVCO;
+	sol->phase_val = d;
+	sol->divby4 = 0;
+
+	return 0;
+}
+
+/* group of @output, or -1 if it isn't part of one */
+static int si5351_output_group(struct si5351_state *st, unsigned int output)
+{
+	unsigned int group;
+
+	for (group = 0; group < SI5351_MAX_GROUPS; group++)
+		if (st->groups[group].mask & BIT(output))
+			return group;
+
+	return -1;
+}
+
+/* the output that stands for its whole group in a tune */
+static unsigned int si5351_group_output(struct si5351_state *st, unsigned int output)
+{
+	int group = si5351_output_group(st, output);
+
+	return (group < 0) ? output : __ffs(st->groups[group].mask);
+}
+
+/*
+ * Output groups. The members of group g run from PLL g and all divide its
+ * VCO by the same even integer d from si5351_solve_quad(). A phase offset of
+ * d quarter VCO periods is then 90 degrees and the output inverter adds 180,
+ * which gives every member 0, 90, 180 or 270 degrees. The whole group is
+ * staged from one solution with a single PLL reset.
+ */
+static void si5351_stage_group(struct si5351_state *st, unsigned int group, struct si5351_tune_solution *sol)
+{
+	unsigned int pll = group;
+	unsigned int start_reg = (pll == PLL_A) ? SI5351_PLLA_PARAMETERS : SI5351_PLLB_PARAMETERS;
+	unsigned long mask = st->groups[group].mask;
+	unsigned int output, phase;
+
+	si5351_write_parameters(st, start_reg, &sol->pll);
+	/* plla/pllb ctrl is in clk6/clk7 ctrl registers */
+	si5351_stage_update_bits(st, SI5351_CLK6_CTRL + pll, SI5351_CLK_INTEGER_MODE,
+			       (sol->pll.p2 == 0) ? SI5351_CLK_INTEGER_MODE : 0);
+
+	for_each_set_bit(output, &mask, SI5351_MAX_CHANNELS)
+	{
+		phase = st->groups[group].phase[output];
+		start_reg = si5351_msynth_params_address(output);
+		/* write multisynth parameters */
+		si5351_write_parameters(st, start_reg, &sol->msynth);
+
+		si5351_stage_update_bits(st, start_reg + 2, SI5351_OUTPUT_CLK_DIVBY4, 0);
+		si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, SI5351_CLK_INTEGER_MODE, 0);
+		si5351_stage_write(st, SI5351_CLK0_PHASE_OFFSET + output,
+				   (phase % 180) ? (sol->phase_val & 0x7F) : 0);
+		si5351_ctrl_msynth(st, output, 1, SI5351_CLK_INPUT_MULTISYNTH_N, SI5351_CLK_DRIVE_STRENGTH_8MA, phase >= 180);
+		si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, SI5351_CLK_PLL_SELECT,
+				       (pll == PLL_B) ? SI5351_CLK_PLL_SELECT : 0);
+
+		dev_dbg(st->dev, "si5351-iio: wrote CTRL byte %02x\n", st->image[SI5351_CLK0_CTRL + output]);
+	}
+
+	/* the phase relation between the members needs a pll soft reset */
+	si5351_stage_pll_reset(st, pll);
+}
+
+/*
+ * Make the outputs in @mask group @group with the given phases, in steps
+ * of 90 degrees; an empty @mask dissolves the group. Outputs leaving the
+ * group are powered down, and powered down outputs outside it are moved to
+ * the other PLL, which is started if it isn't running yet. The new setup
+ * is applied by the next frequency write. Called with all locks held.
+ */
+static int si5351_group_set(struct si5351_state *st, unsigned int group, unsigned long mask, const unsigned int *phase)
+{
+	struct si5351_group *grp = &st->groups[group];
+	unsigned int pll = group, other = (group == PLL_A) ? PLL_B : PLL_A;
+	unsigned long old = grp->mask;
+	unsigned int output;
+	int ret;
+
+	for_each_set_bit(output, &mask, SI5351_MAX_CHANNELS)
+		if (output >= min(6U, st->chip_info->num_channels) ||
+		    phase[output] % 90 || phase[output] >= 360)
+			return -EINVAL;
+
+	if (mask & st->groups[other].mask)
+		return -EBUSY;
+	if (st->seq_running || st->hop_owner[pll])
+		return -EBUSY;
+
+	/* the group's PLL must not feed anything else */
+	for (output = 0; output < st->chip_info->num_channels; output++) {
+		if ((mask | old) & BIT(output))
+			continue;
+		if (si5351_output_pll(st, output) == pll &&
+		    !(st->image[SI5351_CLK0_CTRL + output] & SI5351_CLK_POWERDOWN))
+			return -EBUSY;
+	}
+
+	for (output = 0; output < st->chip_info->num_channels; output++) {
+		if (mask & BIT(output))
+			continue;
+		if (old & BIT(output))
+			si5351_ctrl_msynth(st, output, 0, SI5351_CLK_INPUT_MULTISYNTH_N, SI5351_CLK_DRIVE_STRENGTH_8MA, 0);
+		if (si5351_output_pll(st, output) == pll)
+			si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, SI5351_CLK_PLL_SELECT,
+					       (other == PLL_B) ? SI5351_CLK_PLL_SELECT : 0);
+	}
+
+	if (!st->groups[other].mask && !st->fVCO[other])
+		si5351_set_vco(st, other, si5351_setup_pll(st, other, 32 * st->xtal_rate, st->xtal_rate));
+
+	ret = si5351_commit(st);
+	if (ret < 0)
+		return ret;
+
+	grp->mask = mask;
+	/* outputs may have changed PLLs under the hop table and the plan */
+	st->hop_len = 0;
+	st->plan.valid = 0;
+	for_each_set_bit(output, &mask, SI5351_MAX_CHANNELS)
+		grp->phase[output] = phase[output];
+	st->group_mask = st->groups[PLL_A].mask | st->groups[PLL_B].mask;
+
+	old &= ~mask;
+	for_each_set_bit(output, &old, SI5351_MAX_CHANNELS)
+		si5351_update_caches(st, output, 0, 0);
+
+	dev_dbg(st->dev, "si5351-iio: output group %u set to %02lx\n", group, mask);
+
+	return 0;
+}
+
+/*
+ * "output-group<n>" lists <output phase> pairs. The older "quadrature-mode"
+ * stands for group 0 with outputs 0 and 1 at 0 and 90 degrees.
+ */
+static int si5351_of_group(struct si5351_state *st, struct device_node *np, unsigned int group)
+{
+	u32 cells[2 * SI5351_MAX_CHANNELS];
+	unsigned int phase[SI5351_MAX_CHANNELS];
+	unsigned long mask = 0;
+	char name[16];
+	int i, n, ret;
+
+	snprintf(name, sizeof(name), "output-group%u", group);
+	n = of_property_count_u32_elems(np, name);
+	if (n <= 0) {
+		if (group != 0 || !of_property_read_bool(np, "quadrature-mode"))
+			return 0;
+		dev_dbg(st->dev, "si5351-iio: quadrature mode detected\n");
+		cells[0] = 0;
+		cells[1] = 0;
+		cells[2] = 1;
+		cells[3] = 90;
+		n = 4;
+	} else {
+		if (n % 2 || n > ARRAY_SIZE(cells))
+			return -EINVAL;
+		ret = of_property_read_u32_array(np, name, cells, n);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < n; i += 2) {
+		if (cells[i] >= SI5351_MAX_CHANNELS || (mask & BIT(cells[i])))
+			return -EINVAL;
+		phase[cells[i]] = cells[i + 1];
+		mask |= BIT(cells[i]);
+	}
+
+	si5351_lock_all(st);
+	ret = si5351_group_set(st, group, mask, phase);
+	si5351_unlock_all(st);
+
+	return ret;
+}
+
+/*
+ * Tuning solution cache. Channel plans usually revisit a small set of
+ * frequencies, so solutions are memoized by what they were computed from
+ * and the least recently used entry is replaced on a miss.
+ */
+/* si5351_solve() without the cache */
+static int si5351_solve_direct(struct si5351_state *st, unsigned int kind, unsigned int fref, unsigned int fout_target, unsigned int phase_target, struct si5351_tune_solution *sol)
+{
+	switch (kind) {
+	case SI5351_SOLVE_QUAD:
+		return si5351_solve_quad(st, fref, fout_target, sol);
+	case SI5351_SOLVE_MSYNTH67:
+		si5351_solve_msynth(st, 6, fout_target, fref, phase_target, sol);
+		return 0;
+	default:
+		si5351_solve_msynth(st, 0, fout_target, fref, phase_target, sol);
+		return 0;
+	}
+}
+
+static int si5351_solve(struct si5351_state *st, unsigned int kind, unsigned int fref, unsigned int fout_target, unsigned int phase_target, struct si5351_tune_solution *sol)
+{
+	struct si5351_tune_cache_entry *entry, *victim = NULL;
+	unsigned int i;
+	int ret = 0;
+
+	mutex_lock(&st->tune_cache_lock);
+	for (i = 0; i < st->tune_cache_size; i++) {
+		entry = &st->tune_cache[i];
+		if (entry->valid && entry->kind == kind && entry->fref == fref &&
+		    entry->fout_target == fout_target &&
+		    entry->phase_target == phase_target) {
+			entry->stamp = ++st->tune_cache_clock;
+			*sol = entry->sol;
+			st->tune_cache_hits++;
+			mutex_unlock(&st->tune_cache_lock);
+			return 0;
+		}
+	}
+	st->tune_cache_misses++;
+	mutex_unlock(&st->tune_cache_lock);
+
+	/* solvers of other PLL domains may run meanwhile */
+	ret = si5351_solve_direct(st, kind, fref, fout_target, phase_target, sol);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&st->tune_cache_lock);
+	for (i = 0; i < st->tune_cache_size; i++) {
+		entry = &st->tune_cache[i];
+		if (!entry->valid) {
+			victim = entry;
+			break;
+		}
+		if (!victim || entry->stamp < victim->stamp)
+			victim = entry;
+	}
+
+	if (victim) {
+		victim->kind = kind;
+		victim->fref = fref;
+		victim->fout_target = fout_target;
+		victim->phase_target = phase_target;
+		victim->stamp = ++st->tune_cache_clock;
+		victim->sol = *sol;
+		victim->valid = 1;
+	}
+	mutex_unlock(&st->tune_cache_lock);
+
+	return 0;
+}
+
+/*
+ * Solve for what a frequency/phase write on @output would produce, with the
+ * same paths as a real write, including fine-tune mode. Bypasses the
+ * solution cache so that exploring candidates does not evict the working
+ * set. The reported phase includes the output inverter.
+ */
+static int si5351_query_solution(struct si5351_state *st, unsigned int output, unsigned int fout_target, unsigned int phase_target, struct si5351_tune_solution *sol)
+{
+	unsigned int fout_real, phase_real;
+	int ret;
+
+	ret = si5351_solve_tune(st, output, fout_target, phase_target, false, sol, &fout_real, &phase_real);
+	sol->phase_real = phase_real;
+
+	return ret;
+}
+
+/*
+ * Exact tuning engine. The PLL runs at fXTAL * num / den, so the divider
+ * for a target of T mHz is x = fXTAL * num * 1000 / (den * T). With den
+ * below 2^20 and the VCO below 900 MHz both sides of x fit in 64 bits, and
+ * the best a + b/c is found from the continued fraction of x without any
+ * prescaling, over the full 20 bit range of b and c.
+ */
+
+/* best b/c <= @cmax for p/q < 1, with the semiconvergent rule of lib/math/rational.c */
+static void si5351_best_fraction(u64 p, u64 q, u64 cmax, u64 *b, u64 *c)
+{
+	u64 n = q, d = p, n0 = 1, n1 = 0, d0 = 0, d1 = 1;
+	u64 a, t, dp, quo;
+
+	/* p/q < 1, so the expansion starts at q/p after the convergent 0/1 */
+	while (d) {
+		dp = d;
+		a = div64_u64(n, d);
+		d = n - a * dp;
+		n = dp;
+		if (a > (cmax - d0) / d1) {
+			t = (cmax - d0) / d1;
+			/*
+			 * Take the semiconvergent if it is closer than the last
+			 * convergent. The tie test d0 * dp > d1 * d needs 128 bits,
+			 * the remainder is below d1 and exact in 64 bit arithmetic.
+			 */
+			quo = mul_u64_u64_div_u64(d0, dp, d1);
+			if (2 * t > a ||
+			    (2 * t == a && (quo > d || (quo == d && d0 * dp - quo * d1)))) {
+				n1 = n0 + t * n1;
+				d1 = d0 + t * d1;
+			}
+			break;
+		}
+		t = n0 + a * n1;
+		n0 = n1;
+		n1 = t;
+		t = d0 + a * d1;
+		d0 = d1;
+		d1 = t;
+	}
+
+	*b = n1;
+	*c = d1;
+}
+
+/* the VCO of @pll as (@num / @den) mHz, from the register image */
+static int si5351_pll_exact(struct si5351_state *st, unsigned int pll, u64 *num, u64 *den)
+{
+	unsigned long a, b, c, g;
+
+	si5351_decode_parameters(&st->image[(pll == PLL_A) ? SI5351_PLLA_PARAMETERS : SI5351_PLLB_PARAMETERS],
+				 &a, &b, &c);
+	g = gcd(b ? b : c, c);
+	b /= g;
+	c /= g;
+	/* anything this driver wrote reduces below 2^20 */
+	if (c > SI5351_PLL_C_MAX)
+		return -ERANGE;
+
+	*num = (u64)st->xtal_rate * (a * c + b) * 1000;
+	*den = c;
+
+	return 0;
+}
+
+/* frequency the registers of @output produce, in uHz */
+static int si5351_exact_rate(struct si5351_state *st, unsigned int output, u64 *fout)
+{
+	unsigned long a, b, c;
+	u64 num, den;
+	bool divby4;
+	int ret;
+
+	ret = si5351_pll_exact(st, si5351_output_pll(st, output), &num, &den);
+	if (ret < 0)
+		return ret;
+
+	si5351_msynth_divider(st, output, &a, &b, &c);
+	/*
+	 * Outputs 6 and 7 read a = 0 until they are tuned, and P1 = 0 on the
+	 * others decodes to a = 4 without divide by 4. Neither gives a rate.
+	 */
+	divby4 = output < 6 &&
+		 (st->image[si5351_msynth_params_address(output) + 2] & SI5351_OUTPUT_CLK_DIVBY4);
+	if ((a < SI5351_MULTISYNTH_A_MIN && !divby4) ||
+	    a > ((output >= 6) ? SI5351_MULTISYNTH67_A_MAX : SI5351_MULTISYNTH_A_MAX))
+		return -ENODATA;
+
+	*fout = mul_u64_u64_div_u64(num, (u64)c * 1000, den * ((u64)a * c + b));
+
+	return 0;
+}
+
+/*
+ * Solve @output for @target mHz on its current PLL. The solution is staged
+ * like any multisynth solution; the realised frequency in uHz goes to @fout.
+ */
+static int si5351_solve_exact(struct si5351_state *st, unsigned int output, unsigned int pll, u64 target, unsigned int phase_target, struct si5351_tune_solution *sol, u64 *fout)
+{
+	u64 num, den;
+	int ret;
+
+	ret = si5351_pll_exact(st, pll, &num, &den);
+	if (ret < 0)
+		return ret;
+
+	ret = si5351_solve_ratio(st, output, num, den, target, phase_target, sol, fout);
+	sol->fVCO = st->fVCO[pll];
+
+	return ret;
+}
+
+/*
+ * Solve @output for @target mHz against a VCO of @num / @den mHz, the
+ * PLL's registers for si5351_solve_exact() or the ratio the planner will
+ * program.
+ */
+static int si5351_solve_ratio(struct si5351_state *st, unsigned int output, u64 num, u64 den, u64 target, unsigned int phase_target, struct si5351_tune_solution *sol, u64 *fout)
+{
+	struct si5351_multisynth_parameters *params = &sol->msynth;
+	u64 m, a, b, c, rem, phase_val;
+
+	if (target < (u64)SI5351_MULTISYNTH_MIN_FREQ * 1000 ||
+	    target > (u64)((output >= 6) ? SI5351_MULTISYNTH67_MAX_FREQ : SI5351_MULTISYNTH_DIVBY4_FREQ) * 1000)
+		return -ERANGE;
+
+	m = den * target;
+	if (output >= 6) {
+		a = div64_u64(num + m / 2, m);
+		b = 0;
+		c = 1;
+		if (a < SI5351_MULTISYNTH_A_MIN || a > SI5351_MULTISYNTH67_A_MAX)
+			return -ERANGE;
+	} else {
+		a = div64_u64_rem(num, m, &rem);
+		si5351_best_fraction(rem, m, SI5351_MULTISYNTH_C_MAX, &b, &c);
+		/* the fraction may round up to the next integer */
+		if (b == c) {
+			a++;
+			b = 0;
+			c = 1;
+		}
+		if (a < SI5351_MULTISYNTH_A_MIN || a > SI5351_MULTISYNTH_A_MAX)
+			return -ERANGE;
+	}
+
+	*fout = mul_u64_u64_div_u64(num, c * 1000, den * (a * c + b));
+
+	if (output >= 6) {
+		params->p3 = 0;
+		params->p2 = 0;
+		params->p1 = a;
+	} else {
+		si5351_pll_parameters(a, b, c, params);
+	}
+	params->intmode = (b == 0 && phase_target == 0);
+
+	/* phase offset in quarter VCO periods, as in si5351_solve_msynth() */
+	phase_val = div64_u64((a * c + b) * phase_target, c * 90);
+	if (phase_val > 127)
+		phase_val = 127;
+
+	sol->a = a;
+	sol->b = b;
+	sol->c = c;
+	sol->phase_val = (output < 6) ? phase_val : 0;
+	sol->divby4 = 0;
+	sol->fout_real = (unsigned int)DIV_ROUND_CLOSEST_ULL(*fout, 1000000);
+	sol->phase_real = (unsigned int)div64_u64(sol->phase_val * 90 * c, a * c + b);
+	sol->path = SI5351_PATH_EXACT;
+
+	dev_dbg(st->dev, "si5351-iio: exact a=%llu, b=%llu, c=%llu, fout=%llu uHz\n", a, b, c, *fout);
+
+	return 0;
+}
+
+/*
+ * Tune @output to @target mHz with the exact engine, keeping its phase.
+ * Members of output groups keep their shared solution instead.
+ */
+static int si5351_tune_exact(struct si5351_state *st, unsigned int output, u64 target)
+{
+	struct si5351_tune_solution sol;
+	unsigned int plls, pll, phase;
+	ktime_t start;
+	u8 reset = 0;
+	u64 fout;
+	int ret;
+
+	if (si5351_output_group(st, output) >= 0)
+		return -EINVAL;
+
+	plls = si5351_lock_plls(st, BIT(output));
+	pll = si5351_output_pll(st, output);
+	phase = st->phase_cache[output];
+	trace_si5351_tune_request(st->dev, output, (unsigned int)div_u64(target, 1000), phase);
+	ret = -EBUSY;
+	if (!st->groups[pll].mask) {
+		start = ktime_get();
+		ret = si5351_solve_exact(st, output, pll, target, phase % 180, &sol, &fout);
+		si5351_stats_time(st, st->stats.solve_hist, start);
+	}
+	if (ret == 0)
+		trace_si5351_solve(st->dev, output, &sol, sol.fout_real,
+				   sol.phase_real + ((phase < 180) ? 0 : 180));
+	if (ret == 0) {
+		mutex_lock(&st->bus_lock);
+		si5351_stage_solution(st, output, phase, &sol);
+		ret = si5351_commit(st);
+		if (ret == 0) {
+			si5351_update_caches(st, output, sol.fout_real,
+					     sol.phase_real + ((phase < 180) ? 0 : 180));
+			WRITE_ONCE(st->exact_target[output], target);
+			WRITE_ONCE(st->tune_path[output], SI5351_PATH_EXACT);
+			reset = st->commit_reset;
+		}
+		mutex_unlock(&st->bus_lock);
+	}
+	if (reset)
+		ret = si5351_wait_lock(st, reset);
+	si5351_unlock_plls(st, plls);
+
+	return ret;
+}
+
+/*
+ * Frequency planner. Given the frequencies of a set of outputs it picks
+ * VCO frequencies for both PLLs and assigns every output to one of them,
+ * preferring integer (and among those even) multisynth dividers, which are
+ * exact and jitter best. PLL_A takes the VCO that gives the most outputs an
+ * integer divider, PLL_B the best VCO for the rest, and outputs that are
+ * fractional on both go to PLL_B. A PLL keeps its current VCO whenever that
+ * scores as well as any other, so a request that fits the running setup
+ * does not retune a shared PLL.
+ */
+#define SI5351_PLAN_EVEN	3
+#define SI5351_PLAN_INTEGER	2
+#define SI5351_PLAN_FRACTIONAL	0
+#define SI5351_PLAN_INFEASIBLE	(-100)
+
+/*
+ * The VCO that planning @fVCO on @pll really gives, as @num / @den Hz: the
+ * current registers if the PLL keeps its VCO, else the exact feedback
+ * ratio si5351_setup_pll_ratio() will program.
+ */
+static void si5351_plan_ratio(struct si5351_state *st, unsigned int pll, unsigned int fVCO, u64 *num, u64 *den)
+{
+	unsigned long a, b, c;
+
+	if (fVCO == st->fVCO[pll] && si5351_pll_exact(st, pll, num, den) == 0) {
+		/* si5351_pll_exact() counts in mHz, its numerator is a multiple of 1000 */
+		*num = div_u64(*num, 1000);
+		return;
+	}
+
+	si5351_pll_ratio(fVCO, st->xtal_rate, &a, &b, &c);
+	*num = (u64)st->xtal_rate * (a * c + b);
+	*den = c;
+}
+
+static int si5351_plan_divider_score(unsigned int output, u64 num, u64 den, unsigned int fout)
+{
+	u64 d, rem;
+
+	d = div64_u64_rem(num, den * fout, &rem);
+	if (d < SI5351_MULTISYNTH_A_MIN || d > SI5351_MULTISYNTH_A_MAX)
+		return SI5351_PLAN_INFEASIBLE;
+	/* a fraction on top of the largest divider is out of range */
+	if (rem)
+		return (output >= 6 || d == SI5351_MULTISYNTH_A_MAX) ?
+		       SI5351_PLAN_INFEASIBLE : SI5351_PLAN_FRACTIONAL;
+	if (output >= 6 && d > SI5351_MULTISYNTH67_A_MAX)
+		return SI5351_PLAN_INFEASIBLE;
+
+	return (d & 1) ? SI5351_PLAN_INTEGER : SI5351_PLAN_EVEN;
+}
+
+static int si5351_plan_score(u64 num, u64 den, unsigned long mask, const unsigned int *fout)
+{
+	unsigned int ch;
+	int score = 0;
+
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS)
+		score += si5351_plan_divider_score(ch, num, den, fout[ch]);
+
+	return score;
+}
+
+/* best realisable VCO frequency of @pll for the outputs in @mask, preferring its current one */
+static unsigned int si5351_plan_vco(struct si5351_state *st, unsigned int pll, unsigned long mask, const unsigned int *fout)
+{
+	unsigned int ch, d, dmin, dmax, best = 0, fVCO;
+	int score, best_score = INT_MIN;
+	u64 num, den;
+
+	if (st->fVCO[pll]) {
+		best = st->fVCO[pll];
+		si5351_plan_ratio(st, pll, best, &num, &den);
+		best_score = si5351_plan_score(num, den, mask, fout);
+	}
+
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS) {
+		dmin = max_t(unsigned int, DIV_ROUND_UP(SI5351_PLL_VCO_MIN, fout[ch]), SI5351_MULTISYNTH_A_MIN);
+		dmax = SI5351_PLL_VCO_MAX / fout[ch];
+		for (d = dmin; d <= dmax; d++) {
+			fVCO = fout[ch] * d;
+			si5351_plan_ratio(st, pll, fVCO, &num, &den);
+			score = si5351_plan_score(num, den, mask, fout);
+			if (score > best_score) {
+				best = fVCO;
+				best_score = score;
+			}
+		}
+	}
+
+	return best;
+}
+
+static int si5351_plan_solve(struct si5351_state *st, unsigned long mask, const unsigned int *fout, struct si5351_plan *plan)
+{
+	unsigned long rest = 0;
+	unsigned int ch, pll;
+	int score_a, score_b, ret;
+	u64 num[2], den[2], fexact;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->mask = mask;
+	memcpy(plan->fout_target, fout, sizeof(plan->fout_target));
+
+	plan->fVCO[PLL_A] = si5351_plan_vco(st, PLL_A, mask, fout);
+	si5351_plan_ratio(st, PLL_A, plan->fVCO[PLL_A], &num[PLL_A], &den[PLL_A]);
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS)
+		if (si5351_plan_divider_score(ch, num[PLL_A], den[PLL_A], fout[ch]) < SI5351_PLAN_INTEGER)
+			rest |= BIT(ch);
+
+	if (rest) {
+		plan->fVCO[PLL_B] = si5351_plan_vco(st, PLL_B, rest, fout);
+		si5351_plan_ratio(st, PLL_B, plan->fVCO[PLL_B], &num[PLL_B], &den[PLL_B]);
+	}
+
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS) {
+		score_a = si5351_plan_divider_score(ch, num[PLL_A], den[PLL_A], fout[ch]);
+		score_b = plan->fVCO[PLL_B] ?
+			  si5351_plan_divider_score(ch, num[PLL_B], den[PLL_B], fout[ch]) : SI5351_PLAN_INFEASIBLE;
+		if (score_a == SI5351_PLAN_INFEASIBLE && score_b == SI5351_PLAN_INFEASIBLE)
+			return -ERANGE;
+
+		pll = (score_b >= score_a && score_b > SI5351_PLAN_INFEASIBLE &&
+		       (rest & BIT(ch))) ? PLL_B : PLL_A;
+		plan->pll[ch] = pll;
+		/* against the exact ratio, so the plan reports what the chip will do */
+		ret = si5351_solve_ratio(st, ch, num[pll] * 1000, den[pll], (u64)fout[ch] * 1000,
+					 st->phase_cache[ch] % 180, &plan->sol[ch], &fexact);
+		if (ret < 0)
+			return ret;
+		plan->sol[ch].fVCO = plan->fVCO[pll];
+		plan->sol[ch].path = SI5351_PATH_MSYNTH;
+		if (st->phase_cache[ch] >= 180)
+			plan->sol[ch].phase_real += 180;
+	}
+
+	/* PLL_B is left alone if nothing ends up on it */
+	if (!si5351_plan_uses(plan, PLL_B))
+		plan->fVCO[PLL_B] = 0;
+	plan->valid = 1;
+
+	return 0;
+}
+
+static bool si5351_plan_uses(const struct si5351_plan *plan, unsigned int pll)
+{
+	unsigned int ch;
+
+	for_each_set_bit(ch, &plan->mask, SI5351_MAX_CHANNELS)
+		if (plan->pll[ch] == pll)
+			return true;
+
+	return false;
+}
+
+/*
+ * Program @pll to the exact feedback ratio the planner scored,
+ * si5351_pll_ratio() over the full 20 bit range instead of the prescaled
+ * si5351_solve_pll(). Returns the VCO frequency rounded to Hz.
+ */
+static unsigned int si5351_setup_pll_ratio(struct si5351_state *st, unsigned int pll, unsigned int fVCO)
+{
+	struct si5351_multisynth_parameters params;
+	unsigned long a, b, c;
+
+	si5351_pll_ratio(fVCO, st->xtal_rate, &a, &b, &c);
+	si5351_pll_parameters(a, b, c, &params);
+	si5351_write_parameters(st, (pll == PLL_A) ? SI5351_PLLA_PARAMETERS : SI5351_PLLB_PARAMETERS, &params);
+	si5351_stage_update_bits(st, SI5351_CLK6_CTRL + pll, SI5351_CLK_INTEGER_MODE,
+				 (params.p2 == 0) ? SI5351_CLK_INTEGER_MODE : 0);
+	if (si5351_stage_pll_changed(st, pll))
+		si5351_stage_pll_reset(st, pll);
+
+	return (unsigned int)DIV_ROUND_CLOSEST_ULL((u64)st->xtal_rate * (a * c + b), c);
+}
+
+/* stage and commit a plan, called with all locks held */
+static int si5351_plan_apply(struct si5351_state *st, struct si5351_plan *plan)
+{
+	unsigned int fVCO[2], ch, pll;
+	int ret;
+
+	if (!plan->valid)
+		return -EINVAL;
+
+	for (pll = PLL_A; pll <= PLL_B; pll++) {
+		fVCO[pll] = st->fVCO[pll];
+		if (plan->fVCO[pll] && plan->fVCO[pll] != st->fVCO[pll])
+			fVCO[pll] = si5351_setup_pll_ratio(st, pll, plan->fVCO[pll]);
+	}
+
+	for_each_set_bit(ch, &plan->mask, SI5351_MAX_CHANNELS) {
+		si5351_stage_update_bits(st, SI5351_CLK0_CTRL + ch, SI5351_CLK_PLL_SELECT,
+					 (plan->pll[ch] == PLL_B) ? SI5351_CLK_PLL_SELECT : 0);
+		si5351_stage_solution(st, ch, st->phase_cache[ch], &plan->sol[ch]);
+	}
+
+	ret = si5351_commit(st);
+	if (ret < 0)
+		return ret;
+
+	si5351_set_vco(st, PLL_A, fVCO[PLL_A]);
+	si5351_set_vco(st, PLL_B, fVCO[PLL_B]);
+	/* the plan may have moved the hop channel to the other PLL */
+	if (plan->mask & BIT(st->hop_channel))
+		st->hop_len = 0;
+	for_each_set_bit(ch, &plan->mask, SI5351_MAX_CHANNELS)
+		si5351_update_caches(st, ch, plan->sol[ch].fout_real, plan->sol[ch].phase_real);
+
+	/* prepared ping-pong hops were computed for the old VCOs */
+	memset(st->hop_freq, 0, sizeof(st->hop_freq));
+	memset(st->hop_owner, 0, sizeof(st->hop_owner));
+
+	return 0;
+}
+
+static void si5351_tune_cache_flush(struct si5351_state *st)
+{
+	unsigned int i;
+
+	for (i = 0; i < SI5351_TUNE_CACHE_MAX; i++)
+		st->tune_cache[i].valid = 0;
+}
+
+/*
+ * Fine-tune mode. An output with a PLL to itself keeps its integer
+ * multisynth divider and follows the target with the PLL alone, so a step
+ * only rewrites the PLL parameter block and never resets the PLL. Once the
+ * target leaves the VCO range for that divider, or the phase changes, the
+ * PLL and the divider are planned again around an even integer divider.
+ * Returns -ERANGE if neither works, the caller then solves as usual.
+ */
+static int si5351_solve_fine(struct si5351_state *st, unsigned int output, unsigned int pll, unsigned int fout_target, unsigned int phase_target, struct si5351_tune_solution *sol)
+{
+	struct si5351_tune_solution plan;
+	unsigned long a, b, c, pa, pb, pc, phase_val, cur_val;
+	unsigned long long fVCO;
+	bool invert;
+	int ret;
+
+	si5351_msynth_divider(st, output, &a, &b, &c);
+	fVCO = (unsigned long long)fout_target * a;
+
+	/*
+	 * The PLL path keeps the phase offset register and the inverter, so
+	 * the requested phase has to map to the phase_val the divider already
+	 * has, computed as si5351_solve_msynth() does for b = 0.
+	 */
+	phase_val = min_t(unsigned long, a * (phase_target % 180) / 90, 127);
+	cur_val = (output < 6) ? st->image[SI5351_CLK0_PHASE_OFFSET + output] & 0x7f : 0;
+	invert = st->image[SI5351_CLK0_CTRL + output] & SI5351_CLK_INVERT;
+	if (!b && st->freq_cache[output] && phase_val == cur_val && invert == (phase_target >= 180) &&
+	    fVCO >= SI5351_PLL_VCO_MIN && fVCO <= SI5351_PLL_VCO_MAX) {
+		si5351_pll_ratio(fVCO, st->xtal_rate, &pa, &pb, &pc);
+		si5351_pll_parameters(pa, pb, pc, &sol->pll);
+		fVCO = (unsigned long long)st->xtal_rate * (pa * pc + pb);
+		sol->fout_real = (unsigned int)DIV_ROUND_CLOSEST_ULL(fVCO, (unsigned long long)pc * a);
+		sol->fVCO = (unsigned int)DIV_ROUND_CLOSEST_ULL(fVCO, pc);
+		/* the realized phase of the divider, as in si5351_solve_msynth() */
+		sol->phase_real = phase_val * 90 / a;
+		sol->phase_val = phase_val;
+		sol->a = a;
+		sol->b = 0;
+		sol->c = 1;
+		sol->path = SI5351_PATH_PLL;
+		return 0;
+	}
+
+	ret = si5351_solve_quad(st, st->xtal_rate, fout_target, &plan);
+	if (ret < 0)
+		return ret;
+
+	/*
+	 * Keep the plan's even integer divider. Solving the multisynth again
+	 * against the VCO rounded to Hz could land just below d, on a - 1
+	 * with a fraction, and every later step would replan.
+	 */
+	a = plan.a;
+	phase_val = min_t(unsigned long, a * (phase_target % 180) / 90, 127);
+	if (output >= 6) {
+		sol->msynth.p3 = 0;
+		sol->msynth.p2 = 0;
+		sol->msynth.p1 = a;
+	} else {
+		sol->msynth.p3 = 1;
+		sol->msynth.p2 = 0;
+		sol->msynth.p1 = 128 * a - 512;
+	}
+	sol->msynth.intmode = !(phase_target % 180);
+	sol->pll = plan.pll;
+	sol->fout_real = plan.fout_real;
+	sol->fVCO = plan.fVCO;
+	sol->phase_real = phase_val * 90 / a;
+	sol->phase_val = phase_val;
+	sol->a = a;
+	sol->b = 0;
+	sol->c = 1;
+	sol->divby4 = 0;
+	sol->path = SI5351_PATH_REPLAN;
+
+	return 0;
+}
+
+/*
+ * Solve frequency and phase of one output, or of its whole output group,
+ * and report what they will produce. Only needs the output's PLL domain
+ * lock. Phases of 180 degrees and more use the output inverter. @cached
+ * goes through the solution cache.
+ */
+static int si5351_solve_tune(struct si5351_state *st, unsigned int output, unsigned int fout_target, unsigned int phase_target, bool cached, struct si5351_tune_solution *sol, unsigned int *fout_real, unsigned int *phase_real)
+{
+	unsigned int pll, kind;
+	int group, ret;
+
+	group = si5351_output_group(st, output);
+	if (group >= 0)
+	{
+		if (cached)
+			ret = si5351_solve(st, SI5351_SOLVE_QUAD, st->xtal_rate, fout_target, 0, sol);
+		else
+			ret = si5351_solve_direct(st, SI5351_SOLVE_QUAD, st->xtal_rate, fout_target, 0, sol);
+		sol->path = SI5351_PATH_GROUP;
+		*fout_real = sol->fout_real;
+		*phase_real = st->groups[group].phase[output];
+		return ret;
+	}
+
+	pll = si5351_output_pll(st, output);
+	/* the PLL of an output group feeds nothing else */
+	if (st->groups[pll].mask)
+		return -EBUSY;
+
+	ret = -ERANGE;
+	if (test_bit(output, &st->fine_mask) && !st->hop_owner[pll] &&
+	    !si5351_pll_shared(st, pll, output))
+		ret = si5351_solve_fine(st, output, pll, fout_target, phase_target, sol);
+	if (ret < 0) {
+		kind = (output >= 6) ? SI5351_SOLVE_MSYNTH67 : SI5351_SOLVE_MSYNTH;
+		if (cached)
+			ret = si5351_solve(st, kind, st->fVCO[pll], fout_target, phase_target % 180, sol);
+		else
+			ret = si5351_solve_direct(st, kind, st->fVCO[pll], fout_target, phase_target % 180, sol);
+		sol->path = SI5351_PATH_MSYNTH;
+	}
+	*fout_real = sol->fout_real;
+	*phase_real = sol->phase_real + ((phase_target < 180) ? 0 : 180);
+
+	return ret;
+}
+
+/* stage a si5351_solve_tune() result, called with the bus lock held */
+static void si5351_stage_solution(struct si5351_state *st, unsigned int output, unsigned int phase_target, struct si5351_tune_solution *sol)
+{
+	unsigned int pll;
+	int group;
+
+	group = si5351_output_group(st, output);
+	if (group >= 0)
+	{
+		si5351_stage_group(st, group, sol);
+		si5351_set_vco(st, group, sol->fVCO);
+		return;
+	}
+
+	pll = si5351_output_pll(st, output);
+	if (sol->path == SI5351_PATH_PLL || sol->path == SI5351_PATH_REPLAN) {
+		si5351_write_parameters(st, (pll == PLL_A) ? SI5351_PLLA_PARAMETERS : SI5351_PLLB_PARAMETERS, &sol->pll);
+		/* stay in fractional mode, fine steps may pass through b = 0 */
+		si5351_stage_update_bits(st, SI5351_CLK6_CTRL + pll, SI5351_CLK_INTEGER_MODE, 0);
+		si5351_set_vco(st, pll, sol->fVCO);
+		/* the multisynth, its phase offset and CTRL stay as they are */
+		if (sol->path == SI5351_PATH_PLL)
+			return;
+	}
+	si5351_stage_msynth(st, output, pll, phase_target % 180, sol);
+	si5351_ctrl_msynth(st, output, 1, SI5351_CLK_INPUT_MULTISYNTH_N, SI5351_CLK_DRIVE_STRENGTH_8MA, (phase_target < 180) ? 0 : 1);
+}
+
+/*
+ * Record what a committed tune produced. Called with the bus lock held;
+ * readers go through si5351_read_caches() without it.
+ */
+static void si5351_update_caches(struct si5351_state *st, unsigned int output, unsigned int fout_real, unsigned int phase_real)
+{
+	int group = si5351_output_group(st, output);
+	unsigned long mask = (group >= 0) ? st->groups[group].mask : BIT(output);
+	unsigned int ch;
+
+	/* a plan keeps the outputs it doesn't move at their old frequency */
+	st->plan.valid = 0;
+
+	write_seqcount_begin(&st->cache_seq);
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS) {
+		st->freq_cache[ch] = fout_real;
+		st->phase_cache[ch] = (group >= 0) ? st->groups[group].phase[ch] : phase_real;
+	}
+	write_seqcount_end(&st->cache_seq);
+
+	spin_lock(&st->stats_lock);
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS)
+		st->stats.tunes[ch]++;
+	spin_unlock(&st->stats_lock);
+}
+
+/* consistent frequency and phase of one output, without taking any lock */
+static void si5351_read_caches(struct si5351_state *st, unsigned int output, unsigned int *freq, unsigned int *phase)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&st->cache_seq);
+		*freq = st->freq_cache[output];
+		*phase = st->phase_cache[output];
+	} while (read_seqcount_retry(&st->cache_seq, seq));
+}
+
+/*
+ * Stage every channel in @mask, then send the lot with a single commit.
+ * Resets requested by the channels are merged into one per PLL. The
+ * realised values are also returned in @fout_real and @phase_real if given.
+ */
+static int si5351_txn_commit(struct si5351_state *st, unsigned long mask,
+			     const unsigned int *fout_target, const unsigned int *phase_target,
+			     unsigned int *fout_real, unsigned int *phase_real)
+{
+	struct si5351_tune_solution sol[SI5351_MAX_CHANNELS];
+	unsigned int new_freq[SI5351_MAX_CHANNELS], new_phase[SI5351_MAX_CHANNELS];
+	unsigned int freq, phase[SI5351_MAX_CHANNELS];
+	unsigned int plls, ch, i;
+	unsigned long members;
+	ktime_t start;
+	u8 reset = 0;
+	int group, ret;
+
+	if (!mask)
+		return 0;
+
+	/* the solver only needs the PLL domains involved */
+	plls = si5351_lock_plls(st, mask);
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS) {
+		freq = (fout_target[ch] == SI5351_TUNE_KEEP) ? st->freq_cache[ch] : fout_target[ch];
+		phase[ch] = (phase_target[ch] == SI5351_TUNE_KEEP) ? st->phase_cache[ch] : phase_target[ch];
+		trace_si5351_tune_request(st->dev, ch, freq, phase[ch]);
+		start = ktime_get();
+		ret = si5351_solve_tune(st, ch, freq, phase[ch], true, &sol[ch], &new_freq[ch], &new_phase[ch]);
+		si5351_stats_time(st, st->stats.solve_hist, start);
+		if (ret < 0) {
+			si5351_unlock_plls(st, plls);
+			return ret;
+		}
+		trace_si5351_solve(st->dev, ch, &sol[ch], new_freq[ch], new_phase[ch]);
+	}
+
+	mutex_lock(&st->bus_lock);
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS)
+		si5351_stage_solution(st, ch, phase[ch], &sol[ch]);
+
+	ret = si5351_commit(st);
+	if (ret == 0) {
+		for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS) {
+			si5351_update_caches(st, ch, new_freq[ch], new_phase[ch]);
+			group = si5351_output_group(st, ch);
+			members = (group >= 0) ? st->groups[group].mask : BIT(ch);
+			for_each_set_bit(i, &members, SI5351_MAX_CHANNELS)
+				WRITE_ONCE(st->tune_path[i], sol[ch].path);
+			if (fout_real)
+				fout_real[ch] = new_freq[ch];
+			if (phase_real)
+				phase_real[ch] = new_phase[ch];
+		}
+		reset = st->commit_reset;
+	}
+	mutex_unlock(&st->bus_lock);
+	/* the outputs are settled once the PLLs reset above have locked */
+	if (reset)
+		ret = si5351_wait_lock(st, reset);
+	si5351_unlock_plls(st, plls);
+
+	return ret;
+}
+
+/*
+ * Locking. Each PLL domain has a lock that covers the solver state of the
+ * outputs running from it (their caches and the PLL's VCO frequency), and
+ * the bus lock covers the register image, the shadow and the commit. The
+ * order is PLL_A, PLL_B, bus lock, tune cache lock. Moving an output to the
+ * other PLL needs both PLL locks, so the PLL select bits are stable while
+ * either is held.
+ */
+static unsigned int si5351_output_plls(struct si5351_state *st, unsigned long mask)
+{
+	unsigned int plls = 0, ch;
+	int group;
+
+	/* members of an output group may not have been moved to its PLL yet */
+	for_each_set_bit(ch, &mask, SI5351_MAX_CHANNELS) {
+		group = si5351_output_group(st, ch);
+		plls |= BIT((group >= 0) ? group : si5351_output_pll(st, ch));
+	}
+
+	return plls;
+}
+
+static unsigned int si5351_lock_plls(struct si5351_state *st, unsigned long mask)
+{
+	unsigned int plls;
+
+	for (;;) {
+		plls = si5351_output_plls(st, mask);
+		if (plls & BIT(PLL_A))
+			mutex_lock(&st->pll_lock[PLL_A]);
+		if (plls & BIT(PLL_B))
+			mutex_lock_nested(&st->pll_lock[PLL_B], SINGLE_DEPTH_NESTING);
+		/* an output may have moved to the other PLL meanwhile */
+		if (si5351_output_plls(st, mask) == plls)
+			return plls;
+		si5351_unlock_plls(st, plls);
+	}
+}
+
+static void si5351_unlock_plls(struct si5351_state *st, unsigned int plls)
+{
+	if (plls & BIT(PLL_B))
+		mutex_unlock(&st->pll_lock[PLL_B]);
+	if (plls & BIT(PLL_A))
+		mutex_unlock(&st->pll_lock[PLL_A]);
+}
+
+static void si5351_lock_all(struct si5351_state *st)
+{
+	mutex_lock(&st->pll_lock[PLL_A]);
+	mutex_lock_nested(&st->pll_lock[PLL_B], SINGLE_DEPTH_NESTING);
+	mutex_lock(&st->bus_lock);
+}
+
+static void si5351_unlock_all(struct si5351_state *st)
+{
+	mutex_unlock(&st->bus_lock);
+	mutex_unlock(&st->pll_lock[PLL_B]);
+	mutex_unlock(&st->pll_lock[PLL_A]);
+}
+
+/*
+ * si5351_unlock_all() for a commit that reset the PLLs in @reset: drop the
+ * bus lock, wait for them to lock with only the PLL locks held, like
+ * si5351_txn_commit(), and drop those last.
+ */
+static int si5351_unlock_all_wait(struct si5351_state *st, u8 reset)
+{
+	int ret = 0;
+
+	mutex_unlock(&st->bus_lock);
+	if (reset)
+		ret = si5351_wait_lock(st, reset);
+	mutex_unlock(&st->pll_lock[PLL_B]);
+	mutex_unlock(&st->pll_lock[PLL_A]);
+
+	return ret;
+}
+
+/*
+ * Async mode. A frequency or phase write only records the channel's target
+ * and kicks the worker, which applies the newest target of every pending
+ * channel with one commit. A write that replaces a target still pending is
+ * counted as coalesced. Every applied batch bumps the generation counter,
+ * which can be waited for with poll() on "async_generation".
+ */
+static int si5351_async_queue(struct si5351_state *st, unsigned int output, unsigned int what, unsigned int val)
+{
+	if (what == SI5351_PHASE && (si5351_output_group(st, output) >= 0 || val >= 360))
+		return -EINVAL;
+	if (what != SI5351_FREQ && what != SI5351_PHASE)
+		return -EINVAL;
+
+	/* one frequency retunes a whole output group */
+	output = si5351_group_output(st, output);
+
+	spin_lock(&st->async_lock);
+	st->async_received++;
+	if (st->async_mask & BIT(output)) {
+		st->async_coalesced++;
+	} else {
+		st->async_freq[output] = SI5351_TUNE_KEEP;
+		st->async_phase[output] = SI5351_TUNE_KEEP;
+		st->async_mask |= BIT(output);
+	}
+	if (what == SI5351_FREQ)
+		st->async_freq[output] = val;
+	else
+		st->async_phase[output] = val;
+	spin_unlock(&st->async_lock);
+
+	/* not on seq_wq, a long batch must not delay hop and sweep deadlines */
+	queue_work(system_unbound_wq, &st->async_work);
+
+	return 0;
+}
+
+static void si5351_async_work(struct work_struct *work)
+{
+	struct si5351_state *st = container_of(work, struct si5351_state, async_work);
+	struct iio_dev *indio_dev = dev_get_drvdata(st->dev);
+	unsigned int freq[SI5351_MAX_CHANNELS], phase[SI5351_MAX_CHANNELS];
+	unsigned long mask;
+	int ret;
+
+	spin_lock(&st->async_lock);
+	mask = st->async_mask;
+	memcpy(freq, st->async_freq, sizeof(freq));
+	memcpy(phase, st->async_phase, sizeof(phase));
+	st->async_mask = 0;
+	spin_unlock(&st->async_lock);
+
+	if (!mask)
+		return;
+
+	ret = si5351_txn_commit(st, mask, freq, phase, NULL, NULL);
+
+	spin_lock(&st->async_lock);
+	if (ret == 0) {
+		st->async_applied += hweight_long(mask);
+		st->async_gen++;
+	} else {
+		st->async_errors += hweight_long(mask);
+	}
+	spin_unlock(&st->async_lock);
+
+	if (ret == 0)
+		sysfs_notify(&indio_dev->dev.kobj, NULL, "async_generation");
+}
+
+/*
+ * Buffered output: every trigger pops one sample, a frequency word per
+ * enabled channel, and applies all of them with a single commit.
+ */
+static irqreturn_t si5351_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct si5351_state *st = iio_priv(indio_dev);
+	unsigned int freq[SI5351_MAX_CHANNELS], phase[SI5351_MAX_CHANNELS];
+	unsigned long mask = 0;
+	unsigned int bit, ch, i = 0;
+	int ret;
+
+	ret = iio_pop_from_buffer(indio_dev->buffer, st->scan);
+	if (ret)
+		goto out;
+
+	for_each_set_bit(bit, indio_dev->active_scan_mask, indio_dev->masklength) {
+		/* the word of any member retunes a whole output group */
+		ch = si5351_group_output(st, bit);
+		freq[ch] = st->scan[i++];
+		phase[ch] = SI5351_TUNE_KEEP;
+		mask |= BIT(ch);
+	}
+
+	/* the sample is gone from the buffer either way, count what was lost */
+	ret = si5351_txn_commit(st, mask, freq, phase, NULL, NULL);
+	if (ret < 0) {
+		spin_lock(&st->stats_lock);
+		st->stats.buffer_errors++;
+		spin_unlock(&st->stats_lock);
+		dev_err_ratelimited(st->dev, "si5351-iio: buffered sample not applied: error %d\n", ret);
+	}
+
+out:
+	iio_trigger_notify_done(indio_dev->trig);
+
+	return IRQ_HANDLED;
+}
 
-		fVCO  = (unsigned long)lltmp;
-		fVCO += fXTAL * a;
+static inline unsigned int si5351_msynth_params_length(unsigned int output)
+{
+	return (output >= 6) ? 1 : SI5351_PARAMETERS_LENGTH;
+}
 
-		dev_dbg(&i2c->dev, "si5351-iio: found a=%lu, b=%lu, c=%lu\n", a,  b,  c);
-		dev_dbg(&i2c->dev, "si5351-iio: found p1=%lu, p2=%lu, p3=%lu\n", params.p1, params.p2, params.p3);
+/*
+ * Hop table. Every entry is compiled into the final register bytes of the
+ * table's channel when the table is loaded, so a hop only copies them into
+ * the image and commits, without running the solver.
+ */
+static void si5351_hop_compile(struct si5351_state *st, unsigned int output, unsigned int fout_target, unsigned int phase_target, struct si5351_hop_entry *entry)
+{
+	struct si5351_tune_solution sol;
+	unsigned int pll = si5351_output_pll(st, output);
+	unsigned int phase = phase_target % 180;
+	u8 start_reg = si5351_msynth_params_address(output);
 
-		si5351_write_parameters(i2c, start_reg, &params);
-		/* plla/pllb ctrl is in clk6/clk7 ctrl registers */
-		val = i2c_smbus_read_byte_data(i2c, SI5351_CLK6_CTRL + pll);
-		if (params.p2 == 0)
-			val |= SI5351_CLK_INTEGER_MODE;
-		else
-			val &= ~SI5351_CLK_INTEGER_MODE;
-		i2c_smbus_write_byte_data(i2c, SI5351_CLK6_CTRL + pll, val);
+	si5351_solve(st, (output >= 6) ? SI5351_SOLVE_MSYNTH67 : SI5351_SOLVE_MSYNTH,
+		     st->fVCO[pll], fout_target, phase, &sol);
+	si5351_stage_msynth(st, output, pll, phase, &sol);
+	si5351_ctrl_msynth(st, output, 1, SI5351_CLK_INPUT_MULTISYNTH_N, SI5351_CLK_DRIVE_STRENGTH_8MA, (phase_target < 180) ? 0 : 1);
 
-			/* Do a pll soft reset on the affected pll */
-		i2c_smbus_write_byte_data(i2c, SI5351_PLL_RESET,
-					 (pll == PLL_A) ? SI5351_PLL_RESET_A :
-							    SI5351_PLL_RESET_B);
-		return fVCO;
+	memcpy(entry->params, &st->image[start_reg], si5351_msynth_params_length(output));
+	entry->ctrl = st->image[SI5351_CLK0_CTRL + output];
+	entry->phase_offset = (output < 6) ? st->image[SI5351_CLK0_PHASE_OFFSET + output] : 0;
+	entry->reset = (st->retune_mode == SI5351_RETUNE_PHASE_ALIGNED) || phase;
+	entry->fout_real = sol.fout_real;
+	entry->phase_real = sol.phase_real + ((phase_target < 180) ? 0 : 180);
 
+	/* only the register bytes were wanted, drop the staged state */
+	memcpy(st->image, st->regs, SI5351_REG_COUNT);
+	st->pll_reset = 0;
 }
 
-static inline u8 si5351_msynth_params_address(int num)
+static int si5351_hop_apply(struct si5351_state *st, const struct si5351_hop_entry *entry)
 {
-	if (num > 5)
-		return SI5351_CLK6_PARAMETERS + (num - 6);
-	return SI5351_CLK0_PARAMETERS + (SI5351_PARAMETERS_LENGTH * num);
+	unsigned int output = st->hop_channel;
+	u8 start_reg = si5351_msynth_params_address(output);
+	int ret;
+
+	si5351_stage_bulk(st, start_reg, si5351_msynth_params_length(output), entry->params);
+	si5351_stage_write(st, SI5351_CLK0_CTRL + output, entry->ctrl);
+	si5351_stage_update_bits(st, SI5351_OUTPUT_ENABLE_CTRL, 1 << output, 0);
+	if (output < 6)
+		si5351_stage_write(st, SI5351_CLK0_PHASE_OFFSET + output, entry->phase_offset);
+	if (entry->reset || (output < 6 &&
+	    st->image[SI5351_CLK0_PHASE_OFFSET + output] != st->regs[SI5351_CLK0_PHASE_OFFSET + output]))
+		si5351_stage_pll_reset(st, si5351_output_pll(st, output));
+
+	ret = si5351_commit(st);
+	if (ret == 0)
+		si5351_update_caches(st, output, entry->fout_real, entry->phase_real);
+
+	return ret;
 }
 
-static int si5351_config_msynth_phase(struct i2c_client *i2c, unsigned int output, unsigned int pll, unsigned int fout_target, const unsigned int fVCO, unsigned int phase_target, unsigned int *fout_real, unsigned int *phase_real)
+/*
+ * Frequency sweep. The VCO and the multisynth denominator stay fixed for the
+ * whole sweep, so a step only moves a + b/c: P3 never changes, P1 changes
+ * when 128 * (a + b/c) crosses an integer and P2 takes up the rest. The
+ * delta commit then sends little more than the three P2 bytes per step, and
+ * since the PLL is untouched no reset is needed between steps.
+ */
+static int si5351_sweep_prepare(struct si5351_state *st)
 {
-	struct si5351_multisynth_parameters params;
-	unsigned long a, b, c, phase_val, ultmp;
-	unsigned long long lltmp;
-	int divby4;
-	u8 start_reg;
-	int val;
+	unsigned int output = st->sweep_channel;
+	unsigned int pll = si5351_output_pll(st, output);
+	unsigned int fmin, fmax, fVCO;
+	int ret;
 
-	/* multisync6-7 can only handle freqencies < 150MHz */
-	if (output >= 6 && fout_target > SI5351_MULTISYNTH67_MAX_FREQ)
-		fout_target = SI5351_MULTISYNTH67_MAX_FREQ;
+	if (st->group_mask)
+		return -EBUSY;
+	if (!st->sweep_start || !st->sweep_stop || !st->sweep_step)
+		return -EINVAL;
 
-	/* multisync frequency is 1MHz .. 160MHz */
-	if (fout_target > SI5351_MULTISYNTH_MAX_FREQ)
-		fout_target = SI5351_MULTISYNTH_MAX_FREQ;
-	if (fout_target < SI5351_MULTISYNTH_MIN_FREQ)
-		fout_target = SI5351_MULTISYNTH_MIN_FREQ;
+	fmin = min(st->sweep_start, st->sweep_stop);
+	fmax = max(st->sweep_start, st->sweep_stop);
+	if (fmin < SI5351_MULTISYNTH_MIN_FREQ || fmax > SI5351_MULTISYNTH_DIVBY4_FREQ)
+		return -ERANGE;
 
-	divby4 = 0;
-	if (fout_target > SI5351_MULTISYNTH_DIVBY4_FREQ)
-		divby4 = 1;
+	fVCO = st->fVCO[pll];
+	if (!si5351_pll_shared(st, pll, output) &&
+	    (!st->hop_owner[pll] || st->hop_owner[pll] == output + 1)) {
+		/*
+		 * The lowest usable VCO keeps the span of the divider, and with
+		 * it the number of P1 changes, as small as possible.
+		 */
+		fVCO = max_t(u64, SI5351_PLL_VCO_MIN, (u64)fmax * SI5351_MULTISYNTH_A_MIN);
+		if (fVCO > SI5351_PLL_VCO_MAX)
+			return -ERANGE;
+		fVCO = si5351_setup_pll(st, pll, fVCO, st->xtal_rate);
+	}
 
-	if (output >= 6) {
-		/* determine the closest integer divider */
-		a = DIV_ROUND_CLOSEST(fVCO, fout_target);
-		if (a < SI5351_MULTISYNTH_A_MIN)
-			a = SI5351_MULTISYNTH_A_MIN;
-		if (a > SI5351_MULTISYNTH67_A_MAX)
-			a = SI5351_MULTISYNTH67_A_MAX;
+	if (fVCO / fmax < SI5351_MULTISYNTH_A_MIN || fVCO / fmin >= SI5351_MULTISYNTH_A_MAX) {
+		memcpy(st->image, st->regs, SI5351_REG_COUNT);
+		st->pll_reset = 0;
+		return -ERANGE;
+	}
 
-		b = 0;
-		c = 1;
-	} else {
-		unsigned long rfrac, denom;
+	si5351_ctrl_msynth(st, output, 1, SI5351_CLK_INPUT_MULTISYNTH_N, SI5351_CLK_DRIVE_STRENGTH_8MA, 0);
+	si5351_stage_update_bits(st, si5351_msynth_params_address(output) + 2, SI5351_OUTPUT_CLK_DIVBY4, 0);
+	si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, SI5351_CLK_INTEGER_MODE, 0);
+	si5351_stage_write(st, SI5351_CLK0_PHASE_OFFSET + output, 0);
+	if (st->retune_mode == SI5351_RETUNE_PHASE_ALIGNED)
+		si5351_stage_pll_reset(st, pll);
 
-		/* disable divby4 */
-		if (divby4) {
-			fout_target = SI5351_MULTISYNTH_DIVBY4_FREQ;
-			divby4 = 0;
-		}
+	ret = si5351_commit(st);
+	if (ret < 0)
+		return ret;
 
-		/* determine integer part of divider equation */
-		a = fVCO / fout_target;
-		if (a < SI5351_MULTISYNTH_A_MIN)
-			a = SI5351_MULTISYNTH_A_MIN;
-		if (a > SI5351_MULTISYNTH_A_MAX)
-			a = SI5351_MULTISYNTH_A_MAX;
+	si5351_set_vco(st, pll, fVCO);
+	st->sweep_freq = st->sweep_start;
+	st->sweep_passes = 0;
+	st->sweep_err_last = 0;
+	st->sweep_err_max = 0;
+	st->sweep_num_points = 0;
 
-		/* find best approximation for b/c = fVCO mod fOUT */
-		denom = 1000 * 1000;
-		lltmp = (fVCO) % fout_target;
-		lltmp *= denom;
-		do_div(lltmp, fout_target);
-		rfrac = (unsigned long)lltmp;
+	dev_dbg(st->dev, "si5351-iio: sweep on output %u, PLL %u, fVCO=%u\n", output, pll, fVCO);
 
-		b = 0;
-		c = 1;
-		if (rfrac)
-			rational_best_approximation(rfrac, denom,
-			    SI5351_MULTISYNTH_B_MAX, SI5351_MULTISYNTH_C_MAX,
-			    &b, &c);
-	}
-	if ((b==0) && (phase_target==0))
-		params.intmode=1;
-	else
-		params.intmode=0;
+	return 0;
+}
 
-	/* recalculate fout_target by fOUT = fIN / (a + b/c) */
-	lltmp  = fVCO;
-	lltmp *= c;
-	do_div(lltmp, a * c + b);
-	*fout_real  = (unsigned int)lltmp;
-	//fout_real = f_VCO * c / (a*c + b)
+/* one sweep step, called from the sequencer with all locks held */
+static void si5351_sweep_step(struct si5351_state *st)
+{
+	struct si5351_multisynth_parameters params;
+	unsigned int output = st->sweep_channel;
+	unsigned int pll = si5351_output_pll(st, output);
+	unsigned int f = st->sweep_freq;
+	unsigned long a, b, c = SI5351_MULTISYNTH_C_MAX;
+	u64 num, den, m, rem, lltmp, delta;
+	s64 err;
 
-	/* calculate parameters */
-	if (divby4) {
-		params.p3 = 1;
-		params.p2 = 0;
-		params.p1 = 0;
-	} else if (output >= 6) {
-		params.p3 = 0;
-		params.p2 = 0;
-		params.p1 = a;
-	} else {
-		params.p3  = c;
-		params.p2  = (128 * b) % c;
-		params.p1  = 128 * a;
-		params.p1 += (128 * b / c);
-		params.p1 -= 512;
+	/* the exact VCO in mHz, as for the exact engine, not the rounded fVCO */
+	if (si5351_pll_exact(st, pll, &num, &den) < 0) {
+		num = (u64)st->fVCO[pll] * 1000;
+		den = 1;
 	}
 
-	lltmp = a*c + b;
-	lltmp *= phase_target;
-	do_div(lltmp, c * 90);
-	phase_val = (unsigned long)lltmp;
-	/*
-	The formula for phase_val calculation is: phase_val = (fVCO / *fout_real) * phase_target / 90
-	
-	with fout_real = f_VCO * c / (a*c + b) from above we get
-	
-	phase_val = ((a*c + b) / c ) * phase_target / 90
-	*/
-	if (phase_val > 127)
-	{
-		dev_err(&i2c->dev, "si5351-iio: limiting phase_val from %lu to 127\n", phase_val);
-		phase_val = 127;
+	/* VCO / f = a + b/c, rounded to the nearest b */
+	m = den * f * 1000;
+	a = div64_u64_rem(num, m, &rem);
+	b = (mul_u64_u64_div_u64(2 * rem, c, m) + 1) / 2;
+	if (b == c) {
+		a++;
+		b = 0;
 	}
-	lltmp = *fout_real;
-	lltmp *= phase_val;
-	lltmp *= 90;
-	do_div(lltmp, fVCO);
-	*phase_real = (unsigned int)lltmp;
-	/*
-	The chip implements phase shift by time shifting. The formula for the time shift is
-       	Delta_t = phase_val / (4*fVCO)
-	
-	With the general relation phase = Delta_t * fout * 360 we get
-	phase = phase_val * fout * 90 / fVCO
-	*/
 
-	dev_dbg(&i2c->dev, "si5351-iio: target freq=%u\n", fout_target);
-	dev_dbg(&i2c->dev, "si5351-iio: target phase=%u\n", phase_target);
-	dev_dbg(&i2c->dev, "si5351-iio: using fVCO=%u\n", fVCO);
-	dev_dbg(&i2c->dev, "si5351-iio: found a=%lu, b=%lu, c=%lu\n", a, b, c);
-	dev_dbg(&i2c->dev, "si5351-iio: found p1=%lu, p2=%lu, p3=%lu, divby4=%d\n", params.p1, params.p2, params.p3, divby4);
-	dev_dbg(&i2c->dev, "si5351-iio: fout_real=%u\n", *fout_real);
-	dev_dbg(&i2c->dev, "si5351-iio: phase_val=%lu\n",  phase_val);
-	dev_dbg(&i2c->dev, "si5351-iio: phase_real=%lu\n",  *phase_real);
+	params.p3  = c;
+	params.p2  = (128 * b) % c;
+	params.p1  = 128 * a;
+	params.p1 += (128 * b / c);
+	params.p1 -= 512;
+	si5351_write_parameters(st, si5351_msynth_params_address(output), &params);
 
-	start_reg = si5351_msynth_params_address(output);
-	/* write multisynth parameters */
-	si5351_write_parameters(i2c, start_reg, &params);
-
-	if (fout_target > SI5351_MULTISYNTH_DIVBY4_FREQ)
-		divby4 = 1;
+	if (si5351_commit(st) == 0) {
+		/* realised frequency in mHz, VCO * c / (a*c + b) */
+		lltmp = mul_u64_u64_div_u64(num, c, den * ((u64)a * c + b));
+		err = (s64)lltmp - (s64)f * 1000;
 
-	/* enable/disable integer mode and divby4 on multisynth0-5 */
-	if (output < 6)
-	{
-		val = i2c_smbus_read_byte_data(i2c, start_reg + 2);
-		if (divby4)
-			val |= SI5351_OUTPUT_CLK_DIVBY4;
-		else
-			val &= ~SI5351_OUTPUT_CLK_DIVBY4;
-		i2c_smbus_write_byte_data(i2c, start_reg + 2, val);
+		si5351_update_caches(st, output, (unsigned int)div_u64(lltmp, 1000), 0);
+		st->sweep_err_last = err;
+		if (abs(err) > abs(st->sweep_err_max))
+			st->sweep_err_max = err;
+		if (st->sweep_num_points < SI5351_SWEEP_LOG_MAX) {
+			st->sweep_points[st->sweep_num_points].freq = f;
+			st->sweep_points[st->sweep_num_points].err = (s32)err;
+			st->sweep_num_points++;
+		}
+	}
 
-		val = i2c_smbus_read_byte_data(i2c, SI5351_CLK0_CTRL + output);
-		if (params.intmode == 1)
-			val |= SI5351_CLK_INTEGER_MODE;
-		else
-			val &= ~SI5351_CLK_INTEGER_MODE;
-		i2c_smbus_write_byte_data(i2c, SI5351_CLK0_CTRL + output, val);
-		i2c_smbus_write_byte_data(i2c, SI5351_CLK0_PHASE_OFFSET + output, phase_val & 0x7F);
-		dev_dbg(&i2c->dev, "si5351-iio: readback phase offset %d\n", i2c_smbus_read_byte_data(i2c, SI5351_CLK0_PHASE_OFFSET + output));
+	if (f == st->sweep_stop) {
+		st->sweep_passes++;
+		if (st->sweep_repeat && st->sweep_passes >= st->sweep_repeat)
+			WRITE_ONCE(st->seq_running, 0);
+		st->sweep_freq = st->sweep_start;
+		return;
 	}
 
-	i2c_smbus_write_byte_data(i2c, SI5351_PLL_RESET,
-						 (pll == PLL_A) ? SI5351_PLL_RESET_A :
-								    SI5351_PLL_RESET_B);
+	if (st->sweep_log)
+		delta = max_t(u64, 1, div_u64((u64)f * st->sweep_step, 1000000));
+	else
+		delta = st->sweep_step;
 
-	val = i2c_smbus_read_byte_data(i2c, SI5351_CLK0_CTRL + output);
-	if (pll == PLL_B)
-		val |= SI5351_CLK_PLL_SELECT;
+	if (st->sweep_stop > st->sweep_start)
+		st->sweep_freq = (st->sweep_stop - f > delta) ? f + delta : st->sweep_stop;
 	else
-		val &= ~SI5351_CLK_PLL_SELECT;
-	i2c_smbus_write_byte_data(i2c, SI5351_CLK0_CTRL + output, val);
+		st->sweep_freq = (f - st->sweep_stop > delta) ? f - delta : st->sweep_stop;
+}
 
-	dev_dbg(&i2c->dev, "si5351-iio: wrote CTRL byte %02x\n", val);
+/* one sequencer step, called from the worker with all locks held */
+static void si5351_seq_step(struct si5351_state *st)
+{
+	ktime_t now;
+	s64 lat;
 
-	return 0;
+	switch (st->seq_mode) {
+	case SI5351_SEQ_HOP:
+		/* a retune of the PLL dropped the table under the sequencer */
+		if (!st->hop_len) {
+			WRITE_ONCE(st->seq_running, 0);
+			return;
+		}
+		si5351_hop_apply(st, &st->hop_table[st->hop_pos]);
+		if (++st->hop_pos >= st->hop_len) {
+			st->hop_pos = 0;
+			if (!st->hop_loop)
+				WRITE_ONCE(st->seq_running, 0);
+		}
+		break;
+	case SI5351_SEQ_SWEEP:
+		si5351_sweep_step(st);
+		break;
+	default:
+		WRITE_ONCE(st->seq_running, 0);
+		return;
+	}
+
+	now = ktime_get();
+	lat = ktime_to_ns(ktime_sub(now, st->seq_deadline));
+	if (!st->seq_steps || lat < st->seq_lat_min)
+		st->seq_lat_min = lat;
+	if (lat > st->seq_lat_max)
+		st->seq_lat_max = lat;
+	st->seq_lat_sum += lat;
+
+	if (!st->seq_steps)
+		st->seq_first = now;
+	else {
+		lat = ktime_to_ns(ktime_sub(now, st->seq_last));
+		if (st->seq_steps == 1 || lat < st->seq_interval_min)
+			st->seq_interval_min = lat;
+		if (lat > st->seq_interval_max)
+			st->seq_interval_max = lat;
+	}
+	st->seq_last = now;
+	st->seq_steps++;
 }
 
+static void si5351_seq_work(struct work_struct *work)
+{
+	struct si5351_state *st = container_of(work, struct si5351_state, seq_work);
+
+	si5351_lock_all(st);
+	if (st->seq_running)
+		si5351_seq_step(st);
+	si5351_unlock_all(st);
+}
 
-static unsigned int si5351_ctrl_msynth(struct i2c_client *i2c, unsigned int output, unsigned int enable, unsigned int input, unsigned int strength, unsigned int inversion)
+/*
+ * The bus can't be used from hrtimer context, so the timer only records the
+ * deadline and kicks the worker. A step that is still pending when the next
+ * one is due, and periods the timer skipped entirely, count as missed.
+ */
+static enum hrtimer_restart si5351_seq_timer(struct hrtimer *timer)
 {
-	int val;
-	unsigned int bits = 0, allmask = 0;
+	struct si5351_state *st = container_of(timer, struct si5351_state, seq_timer);
+	u64 overruns;
 
-	allmask = SI5351_CLK_INPUT_MASK | SI5351_CLK_DRIVE_STRENGTH_MASK | SI5351_CLK_INVERT | SI5351_CLK_POWERDOWN;
+	if (!READ_ONCE(st->seq_running))
+		return HRTIMER_NORESTART;
 
-	input &= SI5351_CLK_INPUT_MASK;
-	bits |= input;
+	st->seq_deadline = hrtimer_get_expires(timer);
+	if (!queue_work(st->seq_wq, &st->seq_work))
+		st->seq_missed++;
 
-	strength &= SI5351_CLK_DRIVE_STRENGTH_MASK;
-	bits |= strength;
+	overruns = hrtimer_forward_now(timer, st->seq_period);
+	if (overruns > 1)
+		st->seq_missed += overruns - 1;
 
-	if (inversion!=0)
-		bits |= SI5351_CLK_INVERT;
+	return HRTIMER_RESTART;
+}
 
-	if (enable==0)
-		bits |= SI5351_CLK_POWERDOWN;
+/* called with all locks held */
+static int si5351_seq_start(struct si5351_state *st, unsigned int mode, ktime_t period)
+{
+	if (st->seq_running)
+		return -EBUSY;
 
-	if (output < 8)
-	{
-		val = i2c_smbus_read_byte_data(i2c, SI5351_CLK0_CTRL + output);
-		val &= ~allmask; // remove all masked bits
-		val |= bits; // set bits where needed
-		i2c_smbus_write_byte_data(i2c, SI5351_CLK0_CTRL + output, val);
-		dev_dbg(&i2c->dev, "si5351-iio: wrote CTRL byte %02x\n", val);
-
-		val = i2c_smbus_read_byte_data(i2c, SI5351_OUTPUT_ENABLE_CTRL);
-		if (enable==1)
-			val &= ~(1 << output);
-		else
-			val |=  (1 << output);
-		i2c_smbus_write_byte_data(i2c, SI5351_OUTPUT_ENABLE_CTRL, val);
-		dev_dbg(&i2c->dev, "si5351-iio: wrote OUTPUT ENABLE byte %02x\n", val);
-	}
+	st->seq_mode = mode;
+	st->seq_period = period;
+	st->seq_steps = 0;
+	st->seq_missed = 0;
+	st->seq_lat_min = 0;
+	st->seq_lat_max = 0;
+	st->seq_lat_sum = 0;
+	st->seq_interval_min = 0;
+	st->seq_interval_max = 0;
+	st->seq_running = 1;
+	hrtimer_start(&st->seq_timer, 0, HRTIMER_MODE_REL);
 
-	return bits;
+	return 0;
 }
 
-static int si5351_retune_pll_and_config_msynth_quad(struct i2c_client *i2c, unsigned int pll, unsigned int fXTAL, unsigned int fout_target, unsigned int *fout_real, unsigned int *phase_real)
+/* called without any lock, the worker may be waiting for them */
+static void si5351_seq_stop(struct si5351_state *st)
 {
-	struct si5351_multisynth_parameters pll_params, msynth_params;
-	unsigned long a, b, c, c_start, d;
-	long b_start;
-	unsigned long long lltmp;
-	int val;
-	unsigned long fVCO;
-	unsigned int phase_val;
-	int output;
-	unsigned int fout_by_step;
+	WRITE_ONCE(st->seq_running, 0);
+	hrtimer_cancel(&st->seq_timer);
+	cancel_work_sync(&st->seq_work);
+}
 
-	unsigned int start_reg = (pll == PLL_A) ? SI5351_PLLA_PARAMETERS : SI5351_PLLB_PARAMETERS;
-		
-	fout_by_step = fout_target / TUNE_STEP;
+/*
+ * Character device. Same operations as the IIO attributes, but on packed
+ * structs and for several channels per call, see si5351-iio-ioctl.h.
+ */
+static int si5351_cdev_tune(struct si5351_state *st, unsigned int cmd, struct si5351_ioc_tune *tunes, unsigned int count)
+{
+	unsigned int freq[SI5351_MAX_CHANNELS], phase[SI5351_MAX_CHANNELS];
+	struct si5351_tune_solution sol;
+	unsigned long mask = 0;
+	unsigned int i, ch, plls;
+	int ret;
 
-	a = 32;
-	c_start = fXTAL / TUNE_STEP;
-	d = SI5351_PLL_VCO_MIN / fout_target;
-	while(d <= (SI5351_PLL_VCO_MAX / fout_target))
-	{
-		b_start = (fout_by_step * d) - (a * c_start);
-		if ((b_start >= 0) && (b_start <= (c_start-1)))
-			break;
-		else
-			d++;
-	}
+	for (i = 0; i < count; i++) {
+		ch = tunes[i].channel;
+		if (ch >= st->chip_info->num_channels)
+			return -EINVAL;
 
-	if ((b_start < 0) || (b_start > (c_start-1)))
-	{
-		dev_err(&i2c->dev, "si5351-iio: can't tune to %u Hz\n", fout_target);
-		b_start = 0;
+		switch (cmd) {
+		case SI5351_IOC_GET:
+		case SI5351_IOC_GETV:
+			/* reads don't need any lock */
+			si5351_read_caches(st, ch, &tunes[i].freq, &tunes[i].phase);
+			break;
+		case SI5351_IOC_QUERY:
+			plls = si5351_lock_plls(st, BIT(ch));
+			if (tunes[i].flags & SI5351_TUNE_KEEP_PHASE)
+				tunes[i].phase = st->phase_cache[ch];
+			if (tunes[i].phase >= 360)
+				ret = -EINVAL;
+			else
+				ret = si5351_query_solution(st, ch, tunes[i].freq, tunes[i].phase, &sol);
+			si5351_unlock_plls(st, plls);
+			if (ret < 0)
+				return ret;
+			tunes[i].freq = sol.fout_real;
+			tunes[i].phase = sol.phase_real;
+			break;
+		default:
+			if (tunes[i].flags & SI5351_TUNE_KEEP_PHASE)
+				tunes[i].phase = SI5351_TUNE_KEEP;
+			ret = si5351_txn_check(st, &ch, tunes[i].phase);
+			if (ret < 0 || (mask & BIT(ch)))
+				return -EINVAL;
+			freq[ch] = tunes[i].freq;
+			phase[ch] = tunes[i].phase;
+			mask |= BIT(ch);
+		}
 	}
 
-	b = 0;
-	c = 1;
-	rational_best_approximation(b_start, c_start, SI5351_PLL_B_MAX, SI5351_PLL_C_MAX, &b, &c);
-
-	/* calculate parameters */
-	pll_params.p3  = c;
-	pll_params.p2  = (128 * b) % c;
-	pll_params.p1  = 128 * a;
-	pll_params.p1 += (128 * b / c);
-	pll_params.p1 -= 512;
+	if (cmd != SI5351_IOC_SET && cmd != SI5351_IOC_SUBMIT)
+		return 0;
 
-	/* recalculate rate by fIN * (a + b/c) */
-	lltmp  = fXTAL;
-	lltmp *= b;
-	do_div(lltmp, c);
+	ret = si5351_txn_commit(st, mask, freq, phase, freq, phase);
+	if (ret < 0)
+		return ret;
 
-	fVCO  = (unsigned long)lltmp;
-	fVCO += fXTAL * a;
+	for (i = 0; i < count; i++) {
+		ch = si5351_group_output(st, tunes[i].channel);
+		tunes[i].freq = freq[ch];
+		tunes[i].phase = phase[ch];
+		/* the other members of a group carry their own phases */
+		if (ch != tunes[i].channel)
+			si5351_read_caches(st, tunes[i].channel, &tunes[i].freq, &tunes[i].phase);
+	}
 
-	dev_dbg(&i2c->dev, "si5351-iio: found a=%lu, b=%lu, c=%lu\n", a, b, c);
-	dev_dbg(&i2c->dev, "si5351-iio: found p1=%lu, p2=%lu, p3=%lu\n", pll_params.p1, pll_params.p2, pll_params.p3);
+	return 0;
+}
 
-	si5351_write_parameters(i2c, start_reg, &pll_params);
-	/* plla/pllb ctrl is in clk6/clk7 ctrl registers */
-	val = i2c_smbus_read_byte_data(i2c, SI5351_CLK6_CTRL + pll);
-	if (pll_params.p2 == 0)
-		val |= SI5351_CLK_INTEGER_MODE;
-	else
-		val &= ~SI5351_CLK_INTEGER_MODE;
-	i2c_smbus_write_byte_data(i2c, SI5351_CLK6_CTRL + pll, val);
+static long si5351_cdev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct si5351_state *st = container_of(file->private_data, struct si5351_state, miscdev);
+	struct si5351_ioc_tune tunes[SI5351_MAX_CHANNELS];
+	void __user *argp = (void __user *)arg;
+	struct si5351_ioc_vec vec;
+	int ret;
 
-	/* Do a pll soft reset on the affected pll */
-	i2c_smbus_write_byte_data(i2c, SI5351_PLL_RESET, (pll == PLL_A) ? SI5351_PLL_RESET_A : SI5351_PLL_RESET_B);
+	switch (cmd) {
+	case SI5351_IOC_SET:
+	case SI5351_IOC_GET:
+	case SI5351_IOC_QUERY:
+		if (copy_from_user(&tunes[0], argp, sizeof(tunes[0])))
+			return -EFAULT;
+		ret = si5351_cdev_tune(st, cmd, tunes, 1);
+		if (ret == 0 && copy_to_user(argp, &tunes[0], sizeof(tunes[0])))
+			ret = -EFAULT;
+		return ret;
+	case SI5351_IOC_SUBMIT:
+	case SI5351_IOC_GETV:
+		if (copy_from_user(&vec, argp, sizeof(vec)))
+			return -EFAULT;
+		if (vec.flags || !vec.count || vec.count > SI5351_MAX_CHANNELS)
+			return -EINVAL;
+		if (copy_from_user(tunes, u64_to_user_ptr(vec.tunes), vec.count * sizeof(tunes[0])))
+			return -EFAULT;
+		ret = si5351_cdev_tune(st, cmd, tunes, vec.count);
+		if (ret == 0 && copy_to_user(u64_to_user_ptr(vec.tunes), tunes, vec.count * sizeof(tunes[0])))
+			ret = -EFAULT;
+		return ret;
+	default:
+		return -ENOTTY;
+	}
+}
 
-	// msynth part starts here
-	lltmp  = fVCO;
-	do_div(lltmp, d);
-	*fout_real  = (unsigned int)lltmp;
+static const struct file_operations si5351_cdev_fops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = si5351_cdev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = noop_llseek,
+};
 
-	/* calculate parameters */
-	msynth_params.p3  = 1;
-	msynth_params.p2  = 0;
-	msynth_params.p1  = 128 * d;
-	msynth_params.p1 -= 512;
+/*
+ * debugfs: <debugfs>/si5351/<i2c device>/stats shows the bus traffic,
+ * tunes and PLL resets since probe or the last write to "stats_reset",
+ * and histograms of solver and commit time.
+ */
+static struct dentry *si5351_debugfs_root;
 
-	lltmp = fVCO;
-	do_div(lltmp, *fout_real);
-	phase_val = (unsigned int)lltmp;
-	if (phase_val > 127)
-	{
-		phase_val = 127;
-		dev_err(&i2c->dev, "si5351-iio: limiting phase_val to %u\n",  (unsigned int)phase_val);
-	}
-	lltmp = *fout_real;
-	lltmp *= phase_val;
-	lltmp *= 90;
-	do_div(lltmp, fVCO);
-	*phase_real = (unsigned int)lltmp;
+static void si5351_debugfs_hist(struct seq_file *s, const char *name, const unsigned long long *hist)
+{
+	unsigned int i;
 
-	dev_dbg(&i2c->dev, "si5351-iio: using fVCO=%lu\n", fVCO);
-	dev_dbg(&i2c->dev, "si5351-iio: found d=%lu\n", d);
-	dev_dbg(&i2c->dev, "si5351-iio: found p1=%lu, p2=%lu, p3=%lu\n", msynth_params.p1, msynth_params.p2, msynth_params.p3);
-	dev_dbg(&i2c->dev, "si5351-iio: fout_real=%u\n", *fout_real);
-	dev_dbg(&i2c->dev, "si5351-iio: phase_val=%u\n", phase_val);
+	seq_printf(s, "%s", name);
+	for (i = 0; i < SI5351_STATS_HIST_BUCKETS; i++)
+		seq_printf(s, " %llu", hist[i]);
+	seq_putc(s, '\n');
+}
 
-	/* enable/disable integer mode and divby4 on multisynth0-5 */
-	for (output=0; 2 > output;++output)
-	{
-		start_reg = si5351_msynth_params_address(output);
-		/* write multisynth parameters */
-		si5351_write_parameters(i2c, start_reg, &msynth_params);
+static int si5351_debugfs_stats_show(struct seq_file *s, void *unused)
+{
+	struct si5351_state *st = s->private;
+	struct si5351_stats stats;
+	unsigned int ch;
 
-		val = i2c_smbus_read_byte_data(i2c, start_reg + 2);
-		val &= ~SI5351_OUTPUT_CLK_DIVBY4;
-		i2c_smbus_write_byte_data(i2c, start_reg + 2, val);
+	spin_lock(&st->stats_lock);
+	stats = st->stats;
+	spin_unlock(&st->stats_lock);
 
-		val = i2c_smbus_read_byte_data(i2c, SI5351_CLK0_CTRL + output);
-		val &= ~SI5351_CLK_INTEGER_MODE;
-		i2c_smbus_write_byte_data(i2c, SI5351_CLK0_CTRL + output, val);
-		if(output==1)
-			i2c_smbus_write_byte_data(i2c, SI5351_CLK0_PHASE_OFFSET + output, phase_val & 0x7F);
-		else
-			i2c_smbus_write_byte_data(i2c, SI5351_CLK0_PHASE_OFFSET + output, 0);
+	seq_printf(s, "i2c_reads %llu %llu\n", stats.read_xfers, stats.read_bytes);
+	seq_printf(s, "i2c_writes %llu %llu\n", stats.write_xfers, stats.write_bytes);
+	seq_printf(s, "pll_resets %llu %llu\n", stats.pll_resets[PLL_A], stats.pll_resets[PLL_B]);
+	seq_printf(s, "buffer_errors %llu\n", stats.buffer_errors);
+	seq_printf(s, "tunes");
+	for (ch = 0; ch < st->chip_info->num_channels; ch++)
+		seq_printf(s, " %llu", stats.tunes[ch]);
+	seq_putc(s, '\n');
+	si5351_debugfs_hist(s, "solve_ns", stats.solve_hist);
+	si5351_debugfs_hist(s, "commit_ns", stats.commit_hist);
 
-		dev_dbg(&i2c->dev, "si5351-iio: readback phase offset %d\n", i2c_smbus_read_byte_data(i2c, SI5351_CLK0_PHASE_OFFSET + output));
-	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si5351_debugfs_stats);
 
-	i2c_smbus_write_byte_data(i2c, SI5351_PLL_RESET, (pll == PLL_A) ? SI5351_PLL_RESET_A : SI5351_PLL_RESET_B);
+static ssize_t si5351_debugfs_reset_write(struct file *file, const char __user *ubuf,
+					  size_t len, loff_t *ppos)
+{
+	struct si5351_state *st = file->private_data;
 
-	for (output=0; 2 > output;++output)
-	{
-		val = i2c_smbus_read_byte_data(i2c, SI5351_CLK0_CTRL + output);
-		if (pll == PLL_B)
-			val |= SI5351_CLK_PLL_SELECT;
-		else
-			val &= ~SI5351_CLK_PLL_SELECT;
-		i2c_smbus_write_byte_data(i2c, SI5351_CLK0_CTRL + output, val);
+	spin_lock(&st->stats_lock);
+	memset(&st->stats, 0, sizeof(st->stats));
+	spin_unlock(&st->stats_lock);
 
-		dev_dbg(&i2c->dev, "si5351-iio: wrote CTRL byte %02x\n", val);
-	}
+	return len;
+}
 
-		return fVCO;
+static const struct file_operations si5351_debugfs_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = si5351_debugfs_reset_write,
+	.llseek = noop_llseek,
+};
 
-}	
+static void si5351_debugfs_init(struct si5351_state *st)
+{
+	st->debugfs = debugfs_create_dir(dev_name(st->dev), si5351_debugfs_root);
+	debugfs_create_file("stats", 0400, st->debugfs, st, &si5351_debugfs_stats_fops);
+	debugfs_create_file("stats_reset", 0200, st->debugfs, st, &si5351_debugfs_reset_fops);
+}
 
-static void si5351_safe_defaults(struct i2c_client *i2c)
+static void si5351_safe_defaults(struct si5351_state *st)
 {
 	int i;
-	i2c_smbus_write_byte_data(i2c, SI5351_OUTPUT_ENABLE_CTRL, 0xFF);
+	si5351_stage_write(st, SI5351_OUTPUT_ENABLE_CTRL, 0xFF);
 	for(i=0;i<8;i++)
-		i2c_smbus_write_byte_data(i2c, SI5351_CLK0_CTRL + i, 0x80);
-	i2c_smbus_write_byte_data(i2c, SI5351_CRYSTAL_LOAD, SI5351_CRYSTAL_LOAD_10PF);
+		si5351_stage_write(st, SI5351_CLK0_CTRL + i, 0x80);
+	si5351_stage_write(st, SI5351_CRYSTAL_LOAD, SI5351_CRYSTAL_LOAD_10PF);
 
 	return;
 }
@@ -709,46 +4208,118 @@ static int si5351_i2c_probe(struct i2c_client *i2c,	const struct i2c_device_id *
 			if(ret)
                 		st->xtal_rate = DEFAULT_XTAL_RATE;
 		}
-		st->quad_mode = 0;
-		if (IS_ENABLED(CONFIG_OF) && np)
-		{
-			if (of_property_read_bool(np, "quadrature-mode"))
-                		st->quad_mode = 1;
-		}
-		if (st->quad_mode==1)
-			dev_dbg(&i2c->dev, "si5351-iio: quadrature mode detected\n");
+		st->retune_mode = SI5351_RETUNE_PHASE_ALIGNED;
+		st->tune_cache_size = SI5351_TUNE_CACHE_DEFAULT;
+		st->lock_timeout_us = SI5351_LOCK_DEFAULT_TIMEOUT_US;
 
 		indio_dev->info = &si5351_info;
 		indio_dev->modes = INDIO_DIRECT_MODE;
 		indio_dev->channels = st->chip_info->channels;
 		indio_dev->num_channels = st->chip_info->num_channels;
 
+		mutex_init(&st->bus_lock);
+		mutex_init(&st->pll_lock[PLL_A]);
+		mutex_init(&st->pll_lock[PLL_B]);
+		mutex_init(&st->tune_cache_lock);
+		spin_lock_init(&st->stats_lock);
+		seqcount_mutex_init(&st->cache_seq, &st->bus_lock);
 		for (i = 0; i < st->chip_info->num_channels; ++i) {
 			st->freq_cache[i] = 0;
 			st->phase_cache[i] = 0;
 		}
 
-		ret = iio_device_register(indio_dev);
+		st->bus = i2c_check_functionality(i2c->adapter, I2C_FUNC_I2C) ? &si5351_i2c_bus : &si5351_smbus_bus;
+		ret = si5351_reg_fill_shadow(st);
+		if (ret < 0) {
+			dev_err(&i2c->dev, "failed to read register file: error %d\n", ret);
+			return ret;
+		}
+
+		st->hop_table = devm_kcalloc(&i2c->dev, SI5351_HOP_TABLE_MAX, sizeof(*st->hop_table), GFP_KERNEL);
+		if (!st->hop_table)
+			return -ENOMEM;
+		st->seq_wq = alloc_ordered_workqueue("si5351-%s", WQ_HIGHPRI, dev_name(&i2c->dev));
+		if (!st->seq_wq)
+			return -ENOMEM;
+		INIT_WORK(&st->seq_work, si5351_seq_work);
+		INIT_WORK(&st->async_work, si5351_async_work);
+		spin_lock_init(&st->async_lock);
+		hrtimer_init(&st->seq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		st->seq_timer.function = si5351_seq_timer;
+		st->hop_dwell = us_to_ktime(SI5351_SEQ_DEFAULT_DWELL_US);
+		st->sweep_dwell = us_to_ktime(SI5351_SEQ_DEFAULT_DWELL_US);
+
+		ret = devm_iio_triggered_buffer_setup_ext(&i2c->dev, indio_dev, NULL,
+							  si5351_trigger_handler,
+							  IIO_BUFFER_DIRECTION_OUT,
+							  NULL, NULL);
+		if (ret)
+			goto err_wq;
+
+		/* the chip is set up before anything can reach it from userspace */
+		si5351_lock_all(st);
+		si5351_safe_defaults(st);
+		if (st->chip_info->vcxo)
+			si5351_vcxo_setup(st, np);
+
+		si5351_set_vco(st, PLL_A, si5351_setup_pll(st, PLL_A, 32*st->xtal_rate, st->xtal_rate));
+		ret = si5351_commit(st);
+		si5351_unlock_all(st);
+		if (ret < 0)
+			dev_err(&i2c->dev, "failed to set up PLL_A: error %d\n", ret);
+		printk(KERN_INFO "si5351-iio: Si5351 detected, xtal freq = %d MHz, using PLL_A VCO freq = %d MHz\n", st->xtal_rate/1000000, st->fVCO[PLL_A]/1000000);
+
+		for (i = 0; IS_ENABLED(CONFIG_OF) && np && i < SI5351_MAX_GROUPS; ++i) {
+			ret = si5351_of_group(st, np, i);
+			if (ret < 0)
+				dev_err(&i2c->dev, "invalid output-group%u: error %d\n", i, ret);
+		}
 
-		si5351_safe_defaults(i2c);
+		ret = iio_device_register(indio_dev);
+		if (ret) {
+			dev_err(&i2c->dev, "failed to register IIO device: error %d\n", ret);
+			goto err_wq;
+		}
 
-		st->fVCO = si5351_setup_pll(i2c, PLL_A, 32*st->xtal_rate, st->xtal_rate);
-		printk(KERN_INFO "si5351-iio: Si5351 detected, xtal freq = %d MHz, using PLL_A VCO freq = %d MHz\n", st->xtal_rate/1000000, st->fVCO/1000000);
+		/* the char device goes last, its ioctls tune a fully set up chip */
+		st->miscdev.minor = MISC_DYNAMIC_MINOR;
+		st->miscdev.name = devm_kasprintf(&i2c->dev, GFP_KERNEL, "si5351-%s", dev_name(&i2c->dev));
+		st->miscdev.fops = &si5351_cdev_fops;
+		st->miscdev.parent = &i2c->dev;
+		ret = st->miscdev.name ? misc_register(&st->miscdev) : -ENOMEM;
+		if (ret) {
+			dev_err(&i2c->dev, "failed to register character device: error %d\n", ret);
+			goto err_iio;
+		}
+		si5351_debugfs_init(st);
 
 		return 0;
+
+err_iio:
+		iio_device_unregister(indio_dev);
+err_wq:
+		destroy_workqueue(st->seq_wq);
+		return ret;
 }
 
 static int si5351_i2c_remove(struct i2c_client *i2c)
 {
 		struct iio_dev *indio_dev = dev_get_drvdata(&i2c->dev);
+		struct si5351_state *st = iio_priv(indio_dev);
 
+		debugfs_remove_recursive(st->debugfs);
+		misc_deregister(&st->miscdev);
 		iio_device_unregister(indio_dev);
-		
+		si5351_seq_stop(st);
+		cancel_work_sync(&st->async_work);
+		destroy_workqueue(st->seq_wq);
+
 		return 0;
 }
 
 static const struct i2c_device_id si5351_i2c_ids[] = {
 	{"si5351a", ID_SI5351A },
+	{"si5351b", ID_SI5351B },
 	{"si5351c", ID_SI5351C },
 	{}
 };
@@ -757,6 +4328,7 @@ MODULE_DEVICE_TABLE(i2c, si5351_i2c_ids);
 #ifdef CONFIG_OF
 static const struct of_device_id si5351_of_i2c_match[] = {
 	{ .compatible = "silabs,si5351a", .data = (void *)ID_SI5351A },
+	{ .compatible = "silabs,si5351b", .data = (void *)ID_SI5351B },
 	{ .compatible = "silabs,si5351c", .data = (void *)ID_SI5351C },
 	{ },
 };
@@ -790,6 +4362,7 @@ static int __init si5351_init(void)
 {
 	int ret;
 
+	si5351_debugfs_root = debugfs_create_dir("si5351", NULL);
 	ret = si5351_i2c_register_driver();
 
 	return 0;
@@ -799,6 +4372,7 @@ module_init(si5351_init);
 static void __exit si5351_exit(void)
 {
 	si5351_i2c_unregister_driver();
+	debugfs_remove_recursive(si5351_debugfs_root);
 }
 module_exit(si5351_exit);
 
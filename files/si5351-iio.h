@@ -3,17 +3,32 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/rational.h>
+#include <linux/gcd.h>
+#include <linux/math64.h>
 #include <linux/i2c.h>
 #include <linux/slab.h>
 #include <linux/sysfs.h>
 #include <linux/regulator/consumer.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/seqlock.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <asm/unaligned.h>
 #include <asm/div64.h>
 
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 
 #include "si5351_defs.h"
+#include "si5351-iio-ioctl.h"
 
 static ssize_t si5351_write_ext(struct iio_dev *indio_dev,
 				    uintptr_t private,
@@ -25,16 +40,210 @@ static ssize_t si5351_read_ext(struct iio_dev *indio_dev,
 				   const struct iio_chan_spec *chan,
 				   char *buf);
 
+static ssize_t si5351_write_query(struct iio_dev *indio_dev,
+				  uintptr_t private,
+				  const struct iio_chan_spec *chan,
+				  const char *buf, size_t len);
 
-static int si5351_setup_pll(struct i2c_client *i2c, unsigned int pll, unsigned int fVCO, unsigned int fXTAL);
+static ssize_t si5351_read_query(struct iio_dev *indio_dev,
+				 uintptr_t private,
+				 const struct iio_chan_spec *chan,
+				 char *buf);
+
+static ssize_t si5351_write_hop(struct iio_dev *indio_dev,
+				uintptr_t private,
+				const struct iio_chan_spec *chan,
+				const char *buf, size_t len);
+
+static ssize_t si5351_read_hop(struct iio_dev *indio_dev,
+			       uintptr_t private,
+			       const struct iio_chan_spec *chan,
+			       char *buf);
+
+static ssize_t si5351_write_exact(struct iio_dev *indio_dev,
+				  uintptr_t private,
+				  const struct iio_chan_spec *chan,
+				  const char *buf, size_t len);
+static ssize_t si5351_read_exact(struct iio_dev *indio_dev,
+				 uintptr_t private,
+				 const struct iio_chan_spec *chan,
+				 char *buf);
+static ssize_t si5351_read_fine(struct iio_dev *indio_dev,
+				uintptr_t private,
+				const struct iio_chan_spec *chan,
+				char *buf);
+static ssize_t si5351_write_fine(struct iio_dev *indio_dev,
+				 uintptr_t private,
+				 const struct iio_chan_spec *chan,
+				 const char *buf, size_t len);
+
+static ssize_t si5351_store_tune_cache_size(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t len);
+
+static ssize_t si5351_show_hop(struct device *dev,
+			       struct device_attribute *attr,
+			       char *buf);
+static int si5351_parse_hop_table(struct si5351_state *st, char *table);
+static ssize_t si5351_store_hop(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len);
+static ssize_t si5351_show_async(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf);
+static ssize_t si5351_store_async_mode(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t len);
+static ssize_t si5351_show_txn(struct device *dev,
+			       struct device_attribute *attr,
+			       char *buf);
+static int si5351_txn_check(struct si5351_state *st, unsigned int *ch, unsigned int phase);
+static int si5351_parse_txn(struct si5351_state *st, char *lines);
+static ssize_t si5351_store_txn(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len);
+static ssize_t si5351_show_plan(struct device *dev,
+				struct device_attribute *attr,
+				char *buf);
+static int si5351_parse_plan(struct si5351_state *st, char *list, unsigned long *mask, unsigned int *fout);
+static ssize_t si5351_store_plan(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t len);
+static ssize_t si5351_show_vcxo(struct device *dev,
+				struct device_attribute *attr,
+				char *buf);
+static ssize_t si5351_store_vcxo(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t len);
+static ssize_t si5351_show_lock(struct device *dev,
+				struct device_attribute *attr,
+				char *buf);
+static ssize_t si5351_store_lock(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t len);
+static ssize_t si5351_show_groups(struct device *dev,
+				  struct device_attribute *attr,
+				  char *buf);
+static int si5351_parse_group(char *list, unsigned int *group, unsigned long *mask, unsigned int *phase);
+static ssize_t si5351_store_groups(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t len);
+static ssize_t si5351_show_sweep(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf);
+static ssize_t si5351_store_sweep(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t len);
+
+static int si5351_get_retune_mode(struct iio_dev *indio_dev,
+				  const struct iio_chan_spec *chan);
+static int si5351_set_retune_mode(struct iio_dev *indio_dev,
+				  const struct iio_chan_spec *chan,
+				  unsigned int mode);
+
+static ssize_t si5351_show_stat(struct device *dev,
+				struct device_attribute *attr,
+				char *buf);
+
+static inline bool si5351_reg_volatile(unsigned int reg);
+static int si5351_reg_fill_shadow(struct si5351_state *st);
+static void si5351_stage_write(struct si5351_state *st, unsigned int reg, u8 val);
+static void si5351_stage_update_bits(struct si5351_state *st, unsigned int reg, u8 mask, u8 val);
+static void si5351_stage_bulk(struct si5351_state *st, unsigned int reg, unsigned int len, const u8 *buf);
+static void si5351_stage_pll_reset(struct si5351_state *st, unsigned int pll);
+static bool si5351_stage_pll_changed(struct si5351_state *st, unsigned int pll);
+static inline bool si5351_commit_dirty(struct si5351_state *st, unsigned int reg);
+static inline bool si5351_commit_deferred(unsigned int reg);
+static void si5351_commit_add(struct si5351_state *st, unsigned int reg, const u8 *val, unsigned int len);
+static int si5351_smbus_read(struct si5351_state *st, unsigned int reg, u8 *val, unsigned int len);
+static int si5351_i2c_write(struct si5351_state *st);
+static int si5351_smbus_write(struct si5351_state *st);
+static int si5351_commit(struct si5351_state *st);
+static int si5351_wait_lock(struct si5351_state *st, u8 reset);
+static void si5351_stats_i2c(struct si5351_state *st, bool write, unsigned int bytes);
+static void si5351_stats_time(struct si5351_state *st, unsigned long long *hist, ktime_t start);
+static void si5351_write_parameters(struct si5351_state *st, unsigned int start_reg, struct si5351_multisynth_parameters *params);
+
+static void si5351_pll_parameters(unsigned long a, unsigned long b, unsigned long c, struct si5351_multisynth_parameters *params);
+static void si5351_pll_ratio(unsigned long long fVCO, unsigned int fXTAL, unsigned long *a, unsigned long *b, unsigned long *c);
+static unsigned int si5351_solve_pll(unsigned int fVCO, unsigned int fXTAL, struct si5351_multisynth_parameters *params, unsigned long *a_out, unsigned long *b_out, unsigned long *c_out);
+static int si5351_setup_pll(struct si5351_state *st, unsigned int pll, unsigned int fVCO, unsigned int fXTAL);
+static void si5351_set_vco(struct si5351_state *st, unsigned int pll, unsigned int fVCO);
 
 static inline u8 si5351_msynth_params_address(int num);
 
-static int si5351_retune_pll_and_config_msynth_quad(struct i2c_client *i2c, unsigned int pll, unsigned int fXTAL, unsigned int fout_target, unsigned int *fout_real, unsigned int *phase_real);
 
-static int si5351_config_msynth_phase(struct i2c_client *i2c, unsigned int output, unsigned int pll, unsigned int fout_target, const unsigned int fVCO, unsigned int phase_target, unsigned int *fout_real, unsigned int *phase_real);
-static unsigned int si5351_ctrl_msynth(struct i2c_client *i2c, unsigned int output, unsigned int enable, unsigned int input, unsigned int strength, unsigned int inversion);
-static void si5351_safe_defaults(struct i2c_client *i2c);
+static void si5351_solve_msynth(struct si5351_state *st, unsigned int output, unsigned int fout_target, const unsigned int fVCO, unsigned int phase_target, struct si5351_tune_solution *sol);
+static void si5351_stage_msynth(struct si5351_state *st, unsigned int output, unsigned int pll, unsigned int phase_target, struct si5351_tune_solution *sol);
+static int si5351_solve_quad(struct si5351_state *st, unsigned int fXTAL, unsigned int fout_target, struct si5351_tune_solution *sol);
+static int si5351_output_group(struct si5351_state *st, unsigned int output);
+static unsigned int si5351_group_output(struct si5351_state *st, unsigned int output);
+static void si5351_stage_group(struct si5351_state *st, unsigned int group, struct si5351_tune_solution *sol);
+static int si5351_group_set(struct si5351_state *st, unsigned int group, unsigned long mask, const unsigned int *phase);
+static int si5351_of_group(struct si5351_state *st, struct device_node *np, unsigned int group);
+static int si5351_solve_direct(struct si5351_state *st, unsigned int kind, unsigned int fref, unsigned int fout_target, unsigned int phase_target, struct si5351_tune_solution *sol);
+static int si5351_solve(struct si5351_state *st, unsigned int kind, unsigned int fref, unsigned int fout_target, unsigned int phase_target, struct si5351_tune_solution *sol);
+static int si5351_query_solution(struct si5351_state *st, unsigned int output, unsigned int fout_target, unsigned int phase_target, struct si5351_tune_solution *sol);
+static void si5351_best_fraction(u64 p, u64 q, u64 cmax, u64 *b, u64 *c);
+static int si5351_pll_exact(struct si5351_state *st, unsigned int pll, u64 *num, u64 *den);
+static int si5351_exact_rate(struct si5351_state *st, unsigned int output, u64 *fout);
+static int si5351_solve_exact(struct si5351_state *st, unsigned int output, unsigned int pll, u64 target, unsigned int phase_target, struct si5351_tune_solution *sol, u64 *fout);
+static int si5351_solve_ratio(struct si5351_state *st, unsigned int output, u64 num, u64 den, u64 target, unsigned int phase_target, struct si5351_tune_solution *sol, u64 *fout);
+static int si5351_tune_exact(struct si5351_state *st, unsigned int output, u64 target);
+static void si5351_plan_ratio(struct si5351_state *st, unsigned int pll, unsigned int fVCO, u64 *num, u64 *den);
+static int si5351_plan_divider_score(unsigned int output, u64 num, u64 den, unsigned int fout);
+static int si5351_plan_score(u64 num, u64 den, unsigned long mask, const unsigned int *fout);
+static unsigned int si5351_plan_vco(struct si5351_state *st, unsigned int pll, unsigned long mask, const unsigned int *fout);
+static int si5351_plan_solve(struct si5351_state *st, unsigned long mask, const unsigned int *fout, struct si5351_plan *plan);
+static bool si5351_plan_uses(const struct si5351_plan *plan, unsigned int pll);
+static unsigned int si5351_setup_pll_ratio(struct si5351_state *st, unsigned int pll, unsigned int fVCO);
+static int si5351_plan_apply(struct si5351_state *st, struct si5351_plan *plan);
+static void si5351_tune_cache_flush(struct si5351_state *st);
+static unsigned int si5351_ctrl_msynth(struct si5351_state *st, unsigned int output, unsigned int enable, unsigned int input, unsigned int strength, unsigned int inversion);
+static inline unsigned int si5351_output_pll(struct si5351_state *st, unsigned int output);
+static bool si5351_pll_shared(struct si5351_state *st, unsigned int pll, unsigned int output);
+static void si5351_decode_parameters(const u8 *reg, unsigned long *a, unsigned long *b, unsigned long *c);
+static void si5351_msynth_divider(struct si5351_state *st, unsigned int output, unsigned long *a, unsigned long *b, unsigned long *c);
+static unsigned long long si5351_vcxo_feedback(struct si5351_state *st);
+static int si5351_vcxo_stage(struct si5351_state *st, unsigned long long n);
+static int si5351_vcxo_fine(struct si5351_state *st, int ppb);
+static void si5351_vcxo_setup(struct si5351_state *st, struct device_node *np);
+static int si5351_prepare_hop(struct si5351_state *st, unsigned int output, unsigned int pll, unsigned int fout_target);
+static int si5351_solve_fine(struct si5351_state *st, unsigned int output, unsigned int pll, unsigned int fout_target, unsigned int phase_target, struct si5351_tune_solution *sol);
+static int si5351_solve_tune(struct si5351_state *st, unsigned int output, unsigned int fout_target, unsigned int phase_target, bool cached, struct si5351_tune_solution *sol, unsigned int *fout_real, unsigned int *phase_real);
+static void si5351_stage_solution(struct si5351_state *st, unsigned int output, unsigned int phase_target, struct si5351_tune_solution *sol);
+static void si5351_update_caches(struct si5351_state *st, unsigned int output, unsigned int fout_real, unsigned int phase_real);
+static void si5351_read_caches(struct si5351_state *st, unsigned int output, unsigned int *freq, unsigned int *phase);
+static int si5351_txn_commit(struct si5351_state *st, unsigned long mask,
+			     const unsigned int *fout_target, const unsigned int *phase_target,
+			     unsigned int *fout_real, unsigned int *phase_real);
+static unsigned int si5351_output_plls(struct si5351_state *st, unsigned long mask);
+static unsigned int si5351_lock_plls(struct si5351_state *st, unsigned long mask);
+static void si5351_unlock_plls(struct si5351_state *st, unsigned int plls);
+static void si5351_lock_all(struct si5351_state *st);
+static void si5351_unlock_all(struct si5351_state *st);
+static int si5351_unlock_all_wait(struct si5351_state *st, u8 reset);
+static int si5351_async_queue(struct si5351_state *st, unsigned int output, unsigned int what, unsigned int val);
+static void si5351_async_work(struct work_struct *work);
+static irqreturn_t si5351_trigger_handler(int irq, void *p);
+static inline unsigned int si5351_msynth_params_length(unsigned int output);
+static void si5351_hop_compile(struct si5351_state *st, unsigned int output, unsigned int fout_target, unsigned int phase_target, struct si5351_hop_entry *entry);
+static int si5351_hop_apply(struct si5351_state *st, const struct si5351_hop_entry *entry);
+static int si5351_sweep_prepare(struct si5351_state *st);
+static void si5351_sweep_step(struct si5351_state *st);
+static void si5351_seq_step(struct si5351_state *st);
+static void si5351_seq_work(struct work_struct *work);
+static enum hrtimer_restart si5351_seq_timer(struct hrtimer *timer);
+static int si5351_seq_start(struct si5351_state *st, unsigned int mode, ktime_t period);
+static void si5351_seq_stop(struct si5351_state *st);
+static int si5351_cdev_tune(struct si5351_state *st, unsigned int cmd, struct si5351_ioc_tune *tunes, unsigned int count);
+static long si5351_cdev_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static void si5351_debugfs_hist(struct seq_file *s, const char *name, const unsigned long long *hist);
+static int si5351_debugfs_stats_show(struct seq_file *s, void *unused);
+static ssize_t si5351_debugfs_reset_write(struct file *file, const char __user *ubuf,
+					  size_t len, loff_t *ppos);
+static void si5351_debugfs_init(struct si5351_state *st);
+static void si5351_safe_defaults(struct si5351_state *st);
 static int si5351_identify(struct i2c_client *client);
 static int si5351_i2c_probe(struct i2c_client *i2c,	const struct i2c_device_id *id);
 static int si5351_i2c_remove(struct i2c_client *i2c);
@@ -0,0 +1,175 @@
+/*
+ * si5351-trace.h: tracepoints of the si5351-iio driver
+ *
+ * Licensed under the GPL-2.
+ *
+ * The events follow a tune through the driver: the request, the solver
+ * result, the register bursts of the commit, the PLL reset and the lock.
+ * Enable them with "echo 1 > /sys/kernel/tracing/events/si5351/enable".
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM si5351
+
+#if !defined(_SI5351_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SI5351_TRACE_H
+
+#include <linux/device.h>
+#include <linux/tracepoint.h>
+
+#include "si5351_defs.h"
+
+TRACE_EVENT(si5351_tune_request,
+
+	TP_PROTO(struct device *dev, unsigned int channel, unsigned int freq, unsigned int phase),
+
+	TP_ARGS(dev, channel, freq, phase),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, channel)
+		__field(unsigned int, freq)
+		__field(unsigned int, phase)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->channel = channel;
+		__entry->freq = freq;
+		__entry->phase = phase;
+	),
+
+	TP_printk("%s ch=%u freq=%u phase=%u",
+		  __get_str(dev), __entry->channel, __entry->freq, __entry->phase)
+);
+
+TRACE_EVENT(si5351_solve,
+
+	TP_PROTO(struct device *dev, unsigned int channel,
+		 const struct si5351_tune_solution *sol, unsigned int freq, unsigned int phase),
+
+	TP_ARGS(dev, channel, sol, freq, phase),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, channel)
+		__field(unsigned int, path)
+		__field(unsigned int, fVCO)
+		__field(unsigned long, a)
+		__field(unsigned long, b)
+		__field(unsigned long, c)
+		__field(unsigned long, p1)
+		__field(unsigned long, p2)
+		__field(unsigned long, p3)
+		__field(unsigned long, pll_p1)
+		__field(unsigned long, pll_p2)
+		__field(unsigned long, pll_p3)
+		__field(unsigned int, freq)
+		__field(unsigned int, phase)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->channel = channel;
+		__entry->path = sol->path;
+		__entry->fVCO = sol->fVCO;
+		__entry->a = sol->a;
+		__entry->b = sol->b;
+		__entry->c = sol->c;
+		__entry->p1 = sol->msynth.p1;
+		__entry->p2 = sol->msynth.p2;
+		__entry->p3 = sol->msynth.p3;
+		__entry->pll_p1 = (sol->path == SI5351_PATH_MSYNTH) ? 0 : sol->pll.p1;
+		__entry->pll_p2 = (sol->path == SI5351_PATH_MSYNTH) ? 0 : sol->pll.p2;
+		__entry->pll_p3 = (sol->path == SI5351_PATH_MSYNTH) ? 0 : sol->pll.p3;
+		__entry->freq = freq;
+		__entry->phase = phase;
+	),
+
+	TP_printk("%s ch=%u path=%u fVCO=%u a=%lu b=%lu c=%lu p1=%lu p2=%lu p3=%lu pll_p1=%lu pll_p2=%lu pll_p3=%lu freq=%u phase=%u",
+		  __get_str(dev), __entry->channel, __entry->path, __entry->fVCO,
+		  __entry->a, __entry->b, __entry->c,
+		  __entry->p1, __entry->p2, __entry->p3,
+		  __entry->pll_p1, __entry->pll_p2, __entry->pll_p3,
+		  __entry->freq, __entry->phase)
+);
+
+TRACE_EVENT(si5351_reg_burst,
+
+	TP_PROTO(struct device *dev, unsigned int reg, const u8 *val, unsigned int len),
+
+	TP_ARGS(dev, reg, val, len),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, reg)
+		__field(unsigned int, len)
+		__dynamic_array(u8, val, len)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->reg = reg;
+		__entry->len = len;
+		memcpy(__get_dynamic_array(val), val, len);
+	),
+
+	TP_printk("%s reg=%u len=%u val=%s",
+		  __get_str(dev), __entry->reg, __entry->len,
+		  __print_hex(__get_dynamic_array(val), __entry->len))
+);
+
+TRACE_EVENT(si5351_pll_reset,
+
+	TP_PROTO(struct device *dev, u8 reset),
+
+	TP_ARGS(dev, reset),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u8, reset)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->reset = reset;
+	),
+
+	TP_printk("%s pll_a=%d pll_b=%d", __get_str(dev),
+		  !!(__entry->reset & SI5351_PLL_RESET_A),
+		  !!(__entry->reset & SI5351_PLL_RESET_B))
+);
+
+TRACE_EVENT(si5351_pll_lock,
+
+	TP_PROTO(struct device *dev, unsigned int pll, s64 us, bool locked),
+
+	TP_ARGS(dev, pll, us, locked),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, pll)
+		__field(s64, us)
+		__field(bool, locked)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->pll = pll;
+		__entry->us = us;
+		__entry->locked = locked;
+	),
+
+	TP_printk("%s pll=%c us=%lld %s", __get_str(dev),
+		  'A' + __entry->pll, __entry->us,
+		  __entry->locked ? "locked" : "timeout")
+);
+
+#endif /* _SI5351_TRACE_H */
+
+/* this header is not named after its TRACE_SYSTEM and lives in the module directory */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE si5351-trace
+#include <trace/define_trace.h>
@@ -153,6 +153,8 @@
 #define  SI5351_XTAL_ENABLE			(1<<6)
 #define  SI5351_MULTISYNTH_ENABLE		(1<<4)
 
+#define SI5351_REG_COUNT			(SI5351_FANOUT_ENABLE + 1)
+
 /**
  * enum si5351_variant - SiLabs Si5351 chip variant
  * @SI5351_VARIANT_A: Si5351A (8 output clocks, XTAL input)
@@ -171,11 +173,117 @@ enum si5351_variant {
 #define PLL_A 0
 #define PLL_B 1
 #define DEFAULT_XTAL_RATE 25000000
-#define TUNE_STEP 500
+/* unchanged bytes merged into a run rather than starting a new transfer */
+#define SI5351_COMMIT_MERGE_GAP 1
+/* worst case of one message per changed register plus reset and output enable */
+#define SI5351_COMMIT_MAX_MSGS (SI5351_REG_COUNT / 2 + 2)
+#define SI5351_COMMIT_BUF_LEN (2 * SI5351_REG_COUNT)
+#define SI5351_TUNE_CACHE_MAX 64
+#define SI5351_TUNE_CACHE_DEFAULT 16
+#define SI5351_HOP_TABLE_MAX 256
+#define SI5351_SEQ_MIN_DWELL_US 10
+#define SI5351_SEQ_DEFAULT_DWELL_US 1000
+#define SI5351_SWEEP_LOG_MAX 128
+#define SI5351_MAX_GROUPS 2
+/* PLL_B denominator kept by the Si5351B VCXO fine tune */
+#define SI5351_VCXO_DENOM 1000000
+/* wait-for-lock: status poll interval, default timeout, log2(us) histogram size */
+#define SI5351_LOCK_POLL_US 50
+#define SI5351_LOCK_DEFAULT_TIMEOUT_US 10000
+#define SI5351_LOCK_HIST_BUCKETS 16
+/* debugfs timing histograms, log2(ns) buckets */
+#define SI5351_STATS_HIST_BUCKETS 24
+/* tune target meaning "keep the output's current value" */
+#define SI5351_TUNE_KEEP (~0U)
 
 enum {
 	SI5351_FREQ,
 	SI5351_PHASE,
+	SI5351_HOP_FREQ,
+	SI5351_HOP_COMMIT,
+	SI5351_FINE_TUNE,
+	SI5351_TUNE_PATH,
+};
+
+/* how a tune was carried out, reported by "tune_path" */
+enum {
+	SI5351_PATH_NONE,
+	SI5351_PATH_MSYNTH,
+	SI5351_PATH_PLL,
+	SI5351_PATH_REPLAN,
+	SI5351_PATH_GROUP,
+	SI5351_PATH_EXACT,
+};
+
+enum {
+	SI5351_RETUNE_PHASE_ALIGNED,
+	SI5351_RETUNE_FAST,
+};
+
+enum {
+	SI5351_STAT_LAST_TUNE_BYTES,
+	SI5351_STAT_TOTAL_TUNE_BYTES,
+	SI5351_STAT_COMMITS,
+	SI5351_STAT_TUNE_CACHE_SIZE,
+	SI5351_STAT_TUNE_CACHE_HITS,
+	SI5351_STAT_TUNE_CACHE_MISSES,
+};
+
+enum {
+	SI5351_HOP_TABLE,
+	SI5351_HOP_CHANNEL,
+	SI5351_HOP_DWELL,
+	SI5351_HOP_LOOP,
+	SI5351_HOP_RUN,
+	SI5351_HOP_STATS,
+};
+
+enum {
+	SI5351_PLAN,
+	SI5351_PLAN_APPLY,
+};
+
+enum {
+	SI5351_SWEEP_CHANNEL,
+	SI5351_SWEEP_START,
+	SI5351_SWEEP_STOP,
+	SI5351_SWEEP_STEP,
+	SI5351_SWEEP_LOG,
+	SI5351_SWEEP_DWELL,
+	SI5351_SWEEP_REPEAT,
+	SI5351_SWEEP_RUN,
+	SI5351_SWEEP_STATS,
+	SI5351_SWEEP_ERRORS,
+};
+
+enum {
+	SI5351_ASYNC_MODE,
+	SI5351_ASYNC_GENERATION,
+	SI5351_ASYNC_STATS,
+};
+
+enum {
+	SI5351_TXN_STAGE,
+	SI5351_TXN_COMMIT,
+};
+
+enum {
+	SI5351_OUTPUT_GROUPS,
+	SI5351_VCXO_FINE,
+	SI5351_WAIT_LOCK,
+	SI5351_LOCK_TIMEOUT,
+	SI5351_LOCK_STATS,
+};
+
+enum {
+	SI5351_SEQ_HOP = 1,
+	SI5351_SEQ_SWEEP,
+};
+
+enum {
+	SI5351_SOLVE_MSYNTH,
+	SI5351_SOLVE_MSYNTH67,
+	SI5351_SOLVE_QUAD,
 };
 
 struct si5351_multisynth_parameters {
@@ -186,35 +294,234 @@ struct si5351_multisynth_parameters {
 	int		intmode;
 };
 
+struct si5351_state;
+
+/* register file access, see si5351_i2c_bus */
+struct si5351_bus_ops {
+	/* read @len registers starting at @reg */
+	int (*read)(struct si5351_state *st, unsigned int reg, u8 *val, unsigned int len);
+	/* send st->msgs as staged by si5351_commit() */
+	int (*write)(struct si5351_state *st);
+};
+
+/* bus traffic and timing, reported in debugfs */
+struct si5351_stats {
+	unsigned long long	read_xfers;
+	unsigned long long	read_bytes;
+	unsigned long long	write_xfers;
+	unsigned long long	write_bytes;
+	unsigned long long	tunes[SI5351_MAX_CHANNELS];
+	unsigned long long	pll_resets[2];
+	unsigned long long	buffer_errors;
+	unsigned long long	solve_hist[SI5351_STATS_HIST_BUCKETS];
+	unsigned long long	commit_hist[SI5351_STATS_HIST_BUCKETS];
+};
+
+/* everything needed to stage a tune without redoing the math */
+struct si5351_tune_solution {
+	struct si5351_multisynth_parameters pll;	/* all paths but SI5351_PATH_MSYNTH */
+	struct si5351_multisynth_parameters msynth;
+	unsigned long	a;
+	unsigned long	b;
+	unsigned long	c;
+	unsigned int	fVCO;
+	unsigned int	phase_val;
+	int		divby4;
+	unsigned int	fout_real;
+	unsigned int	phase_real;
+	unsigned int	path;
+};
+
+/* PLL frequencies and output assignment computed by si5351_plan_solve() */
+struct si5351_plan {
+	unsigned int	fVCO[2];	/* 0: PLL left unchanged */
+	unsigned long	mask;
+	unsigned int	fout_target[SI5351_MAX_CHANNELS];
+	unsigned int	pll[SI5351_MAX_CHANNELS];
+	struct si5351_tune_solution sol[SI5351_MAX_CHANNELS];
+	int		valid;
+};
+
+/* outputs locked to one PLL with fixed phases, see si5351_group_set() */
+struct si5351_group {
+	unsigned long	mask;
+	unsigned int	phase[SI5351_MAX_CHANNELS];
+};
+
+struct si5351_tune_cache_entry {
+	unsigned int	kind;
+	unsigned int	fref;
+	unsigned int	fout_target;
+	unsigned int	phase_target;
+	unsigned long	stamp;
+	int		valid;
+	struct si5351_tune_solution sol;
+};
+
+struct si5351_query {
+	unsigned int	fout_target;
+	unsigned int	phase_target;
+	struct si5351_tune_solution sol;
+};
+
+/* register bytes of one hop table entry, see si5351_hop_compile() */
+struct si5351_hop_entry {
+	u8		params[SI5351_PARAMETERS_LENGTH];
+	u8		ctrl;
+	u8		phase_offset;
+	u8		reset;
+	unsigned int	fout_real;
+	unsigned int	phase_real;
+};
+
+/* one logged sweep step: target in Hz, error of the realised frequency in mHz */
+struct si5351_sweep_point {
+	unsigned int	freq;
+	s32		err;
+};
+
 struct si5351_chip_info {
 	const struct iio_chan_spec *channels;
 	unsigned int num_channels;
+	int vcxo;
 };
 
 struct si5351_state {
 	struct device			*dev;
 	const struct si5351_chip_info	*chip_info;
+	/* see si5351_lock_plls() for what these protect */
+	struct mutex			pll_lock[2];
+	struct mutex			bus_lock;
+	struct mutex			tune_cache_lock;
+	/* written under the bus lock, read lock-free under cache_seq */
+	seqcount_mutex_t		cache_seq;
 	unsigned int			freq_cache[SI5351_MAX_CHANNELS];
 	unsigned int			phase_cache[SI5351_MAX_CHANNELS];
-	unsigned int			fVCO;
+	unsigned int			fVCO[2];
 	unsigned int			xtal_rate;
-	int 				quad_mode;
+	/* output group g runs from PLL g */
+	struct si5351_group		groups[SI5351_MAX_GROUPS];
+	unsigned long			group_mask;
+	/* Si5351B VCXO fine tune: PLL_B feedback it started from and last set */
+	unsigned long long		vcxo_base;
+	unsigned long long		vcxo_last;
+	int				vcxo_ppb;
+	int				retune_mode;
+	/* channels in fine-tune mode and how each was last tuned */
+	unsigned long			fine_mask;
+	u8				tune_path[SI5351_MAX_CHANNELS];
+	/* target of the last "frequency_exact" write, in mHz */
+	u64				exact_target[SI5351_MAX_CHANNELS];
+	/* wait for PLL lock after resets, lock times per PLL under its pll_lock */
+	int				wait_lock;
+	unsigned int			lock_timeout_us;
+	unsigned long long		lock_hist[2][SI5351_LOCK_HIST_BUCKETS];
+	unsigned long long		lock_timeouts[2];
+	/* debugfs directory and the statistics it shows */
+	struct dentry			*debugfs;
+	spinlock_t			stats_lock;
+	struct si5351_stats		stats;
+	/* PLL ping-pong: prepared frequency per output, owner+1 per idle PLL */
+	unsigned int			hop_freq[SI5351_MAX_CHANNELS];
+	unsigned int			hop_owner[2];
+	struct si5351_tune_cache_entry	tune_cache[SI5351_TUNE_CACHE_MAX];
+	unsigned int			tune_cache_size;
+	unsigned long			tune_cache_clock;
+	unsigned long long		tune_cache_hits;
+	unsigned long long		tune_cache_misses;
+	struct si5351_query		query[SI5351_MAX_CHANNELS];
+	struct si5351_plan		plan;
+	/* channels staged for the next transaction commit */
+	unsigned long			txn_mask;
+	unsigned int			txn_freq[SI5351_MAX_CHANNELS];
+	unsigned int			txn_phase[SI5351_MAX_CHANNELS];
+	struct miscdevice		miscdev;
+	/* async mode: latest pending target per channel, applied by async_work */
+	spinlock_t			async_lock;
+	int				async_mode;
+	struct work_struct		async_work;
+	unsigned long			async_mask;
+	unsigned int			async_freq[SI5351_MAX_CHANNELS];
+	unsigned int			async_phase[SI5351_MAX_CHANNELS];
+	unsigned long long		async_received;
+	unsigned long long		async_applied;
+	unsigned long long		async_coalesced;
+	unsigned long long		async_errors;
+	unsigned long long		async_gen;
+	/* hop table and the hrtimer driven sequencer stepping through it */
+	struct si5351_hop_entry		*hop_table;
+	unsigned int			hop_len;
+	unsigned int			hop_pos;
+	unsigned int			hop_channel;
+	int				hop_loop;
+	ktime_t				hop_dwell;
+	/* frequency sweep, also paced by the sequencer */
+	unsigned int			sweep_channel;
+	unsigned int			sweep_start;
+	unsigned int			sweep_stop;
+	unsigned int			sweep_step;
+	int				sweep_log;
+	ktime_t				sweep_dwell;
+	unsigned int			sweep_repeat;
+	unsigned int			sweep_freq;
+	unsigned int			sweep_passes;
+	s64				sweep_err_last;
+	s64				sweep_err_max;
+	struct si5351_sweep_point	sweep_points[SI5351_SWEEP_LOG_MAX];
+	unsigned int			sweep_num_points;
+	struct hrtimer			seq_timer;
+	struct work_struct		seq_work;
+	struct workqueue_struct		*seq_wq;
+	ktime_t				seq_period;
+	ktime_t				seq_deadline;
+	ktime_t				seq_first;
+	ktime_t				seq_last;
+	unsigned int			seq_mode;
+	int				seq_running;
+	unsigned long long		seq_steps;
+	unsigned long long		seq_missed;
+	s64				seq_lat_min;
+	s64				seq_lat_max;
+	s64				seq_lat_sum;
+	s64				seq_interval_min;
+	s64				seq_interval_max;
+	/* shadow of the chip's register file and the image staged for the next commit */
+	u8				regs[SI5351_REG_COUNT];
+	u8				image[SI5351_REG_COUNT];
+	/* a failed commit couldn't be read back, the shadow can't be trusted */
+	bool				shadow_stale;
+	u8				pll_reset;
+	/* resets sent by the last commit */
+	u8				commit_reset;
+	unsigned int			commit_bytes;
+	unsigned int			last_tune_bytes;
+	unsigned long long		total_tune_bytes;
+	unsigned long long		commits;
+	const struct si5351_bus_ops	*bus;
+	struct i2c_msg			msgs[SI5351_COMMIT_MAX_MSGS];
+	unsigned int			num_msgs;
+	unsigned int			xfer_len;
+	/* one output buffer sample, a frequency word per channel */
+	u32				scan[SI5351_MAX_CHANNELS];
 	/*
 	 * DMA (thus cache coherency maintenance) requires the
 	 * transfer buffers to live in their own cache lines.
 	 */
 	union {
 		u8 i2c[3];
+		u8 xfer[SI5351_COMMIT_BUF_LEN];
 	} data ____cacheline_aligned;
 };
 
 /*
 enum si5351_type {
 	ID_SI5351A,
+	ID_SI5351B,
 	ID_SI5351C,
 };
 */
 #define ID_SI5351A 0x60
 #define ID_SI5351C 0x61
+#define ID_SI5351B 0x62
 
 #endif
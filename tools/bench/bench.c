@@ -0,0 +1,841 @@
+/*
+ * bench.c: userspace benchmark of the si5351-iio tuning path
+ *
+ * Licensed under the GPL-2.
+ *
+ * The driver is compiled into this program as is, with host.h standing in
+ * for the kernel and the mock register file for the chip. Every tune runs
+ * the same solve, stage and commit steps as a "frequency" write, timed one
+ * by one, over a set of frequencies given on the command line.
+ *
+ * With -R, reader threads poll the tuned output the way a "frequency" read
+ * does while the tunes run, and again with the chip idle, to show that the
+ * lock-free read path does not wait for retunes. With -t, the same tunes
+ * run from 1 to n threads over one or more chips, to show how the per-PLL
+ * and bus locks scale.
+ *
+ * The fine and vcxo modes check every step on the mock: a step that took
+ * the PLL-only path may only write its PLL's parameter block and feedback
+ * integer-mode bit, in at most one (vcxo) or two (fine) transfers, and
+ * must not reset the PLL. The run fails if any step does more.
+ *
+ * PLL lock time, the sysfs and ioctl entry points, and everything behind a
+ * workqueue or hrtimer (async writes, hop table, sweeps) are not covered,
+ * see the README.
+ */
+
+#include <getopt.h>
+
+#include "si5351-iio.c"
+#include "mock.h"
+
+enum {
+	BENCH_SOLVE,
+	BENCH_STAGE,
+	BENCH_COMMIT,
+	BENCH_PHASES,
+};
+
+static const char * const bench_phase_names[BENCH_PHASES] = {
+	[BENCH_SOLVE] = "solve",
+	[BENCH_STAGE] = "stage",
+	[BENCH_COMMIT] = "commit",
+};
+
+static const char * const bench_modes[] = {
+	"msynth",	/* multisynth only, PLL fixed */
+	"fine",		/* fine-tune mode, PLL first */
+	"group",	/* output group 0 = {0:0, 1:90} */
+	"exact",	/* exact engine, mHz targets */
+	"vcxo",		/* Si5351B VCXO fine tune, steps in ppb */
+};
+
+enum {
+	BENCH_MSYNTH,
+	BENCH_FINE,
+	BENCH_GROUP,
+	BENCH_EXACT,
+	BENCH_VCXO,
+};
+
+struct bench_timing {
+	s64		sum;
+	s64		min;
+	s64		max;
+};
+
+/* read latency in steps of 8 ns up to 64 us, the rest in the last bucket */
+#define BENCH_LAT_SHIFT		3
+#define BENCH_LAT_BUCKETS	8192
+
+struct bench_reader {
+	pthread_t		thread;
+	struct si5351_state	*st;
+	unsigned int		output;
+	unsigned long long	reads;
+	s64			max;
+	unsigned long long	hist[BENCH_LAT_BUCKETS];
+};
+
+static int bench_stop;
+
+/* everything that shapes a run, from the command line */
+struct bench_config {
+	unsigned int		mode;
+	unsigned int		output;
+	unsigned int		phase;
+	unsigned int		passes;
+	unsigned int		cache_size;
+	unsigned int		xtal;
+	unsigned int		bus_khz;
+	bool			smbus;
+	unsigned int		readers;
+	unsigned int		threads;
+	unsigned int		chips;
+	unsigned int		*freqs;
+	unsigned int		count;
+};
+
+/* what the fine and vcxo steps wrote */
+struct bench_steps {
+	unsigned long long	pll;
+	unsigned long long	full;
+	unsigned long long	bad;
+	unsigned long long	max_xfers;
+	unsigned long long	max_bytes;
+	unsigned long long	xfers;
+	unsigned long long	bytes;
+	unsigned long long	resets;
+};
+
+/* a tuning thread of the scaling run, on one output of one chip */
+struct bench_worker {
+	pthread_t		thread;
+	const struct bench_config *cfg;
+	struct si5351_state	*st;
+	unsigned int		output;
+	unsigned long long	ok;
+	unsigned long long	failed;
+	struct bench_timing	timing[BENCH_PHASES];
+};
+
+static void bench_time(struct bench_timing *t, ktime_t start, ktime_t end)
+{
+	s64 ns = ktime_to_ns(ktime_sub(end, start));
+
+	t->sum += ns;
+	if (!t->min || ns < t->min)
+		t->min = ns;
+	if (ns > t->max)
+		t->max = ns;
+}
+
+/* what si5351_i2c_probe() does to a fresh chip, minus the registration */
+static struct si5351_state *bench_setup(const struct bench_config *cfg, struct si5351_mock *mock)
+{
+	struct si5351_state *st;
+	int ret;
+
+	st = aligned_alloc(64, round_up(sizeof(*st), 64));
+	if (!st)
+		return NULL;
+	memset(st, 0, sizeof(*st));
+
+	st->dev = &mock->client.dev;
+	st->chip_info = &si5351_chip_info_tbl[(cfg->mode == BENCH_VCXO) ? ID_SI5351B : ID_SI5351C];
+	st->xtal_rate = cfg->xtal;
+	st->retune_mode = SI5351_RETUNE_PHASE_ALIGNED;
+	st->tune_cache_size = cfg->cache_size;
+	st->lock_timeout_us = SI5351_LOCK_DEFAULT_TIMEOUT_US;
+	st->bus = cfg->smbus ? &si5351_mock_smbus_bus : &si5351_mock_i2c_bus;
+	mutex_init(&st->bus_lock);
+	mutex_init(&st->pll_lock[PLL_A]);
+	mutex_init(&st->pll_lock[PLL_B]);
+	mutex_init(&st->tune_cache_lock);
+	spin_lock_init(&st->stats_lock);
+	seqcount_mutex_init(&st->cache_seq, &st->bus_lock);
+
+	ret = si5351_reg_fill_shadow(st);
+	if (ret == 0) {
+		si5351_safe_defaults(st);
+		si5351_set_vco(st, PLL_A, si5351_setup_pll(st, PLL_A, 32 * cfg->xtal, cfg->xtal));
+		ret = si5351_commit(st);
+	}
+	if (ret < 0) {
+		free(st);
+		return NULL;
+	}
+
+	return st;
+}
+
+/* start PLL_B and move the odd outputs to it, for two PLL domains */
+static int bench_split_plls(struct si5351_state *st)
+{
+	unsigned int output;
+
+	si5351_set_vco(st, PLL_B, si5351_setup_pll(st, PLL_B, 32 * st->xtal_rate, st->xtal_rate));
+	for (output = 1; output < st->chip_info->num_channels; output += 2)
+		si5351_stage_update_bits(st, SI5351_CLK0_CTRL + output, SI5351_CLK_PLL_SELECT,
+					 SI5351_CLK_PLL_SELECT);
+
+	return si5351_commit(st);
+}
+
+/*
+ * One tune of @output, the steps of si5351_txn_commit() and
+ * si5351_tune_exact() with the same locks, so the reader threads see the
+ * driver's own seqcount updates.
+ */
+static int bench_tune(struct si5351_state *st, unsigned int mode, unsigned int output,
+		      unsigned int freq, unsigned int phase, struct bench_timing *t, unsigned int *path)
+{
+	struct si5351_tune_solution sol;
+	unsigned int fout_real, phase_real;
+	ktime_t t0, t1, t2, t3;
+	unsigned int plls;
+	u64 fout;
+	int ret;
+
+	plls = si5351_lock_plls(st, BIT(output));
+	t0 = ktime_get();
+	if (mode == BENCH_VCXO) {
+		/* si5351_vcxo_fine() solves, stages and commits, all timed as the commit */
+		mutex_lock(&st->bus_lock);
+		t1 = ktime_get();
+		ret = si5351_vcxo_fine(st, (int)freq);
+		t3 = ktime_get();
+		mutex_unlock(&st->bus_lock);
+		si5351_unlock_plls(st, plls);
+		if (ret < 0)
+			return ret;
+
+		bench_time(&t[BENCH_SOLVE], t0, t0);
+		bench_time(&t[BENCH_STAGE], t1, t1);
+		bench_time(&t[BENCH_COMMIT], t1, t3);
+		if (path)
+			*path = SI5351_PATH_PLL;
+		return 0;
+	}
+	if (mode == BENCH_EXACT) {
+		ret = si5351_solve_exact(st, output, si5351_output_pll(st, output),
+					 (u64)freq * 1000, phase % 180, &sol, &fout);
+		fout_real = sol.fout_real;
+		phase_real = sol.phase_real + ((phase < 180) ? 0 : 180);
+	} else {
+		ret = si5351_solve_tune(st, output, freq, phase, true, &sol, &fout_real, &phase_real);
+	}
+	t1 = ktime_get();
+	if (ret < 0) {
+		si5351_unlock_plls(st, plls);
+		return ret;
+	}
+
+	mutex_lock(&st->bus_lock);
+	si5351_stage_solution(st, output, phase, &sol);
+	t2 = ktime_get();
+	ret = si5351_commit(st);
+	t3 = ktime_get();
+	if (ret == 0)
+		si5351_update_caches(st, output, fout_real, phase_real);
+	mutex_unlock(&st->bus_lock);
+	si5351_unlock_plls(st, plls);
+	if (ret < 0)
+		return ret;
+
+	bench_time(&t[BENCH_SOLVE], t0, t1);
+	bench_time(&t[BENCH_STAGE], t1, t2);
+	bench_time(&t[BENCH_COMMIT], t2, t3);
+	if (path)
+		*path = sol.path;
+
+	return 0;
+}
+
+static void bench_step_begin(struct bench_steps *s, struct si5351_mock *mock)
+{
+	s->xfers = mock->write_xfers;
+	s->bytes = mock->write_bytes;
+	s->resets = mock->pll_resets;
+	memset(mock->written, 0, sizeof(mock->written));
+}
+
+/*
+ * Check the registers a step on @pll wrote against the path it took. A
+ * VCXO step keeps c, so only P1 and P2 change and go out in one transfer.
+ * A fine step may change P3 too, which sits too far from P2 for the
+ * commit to merge them.
+ */
+static void bench_step_end(struct bench_steps *s, const struct si5351_mock *mock,
+			   unsigned int mode, unsigned int pll, unsigned int path)
+{
+	unsigned int base = (pll == PLL_A) ? SI5351_PLLA_PARAMETERS : SI5351_PLLB_PARAMETERS;
+	unsigned long long xfers = mock->write_xfers - s->xfers;
+	unsigned long long bytes = mock->write_bytes - s->bytes;
+	unsigned int reg;
+	bool bad;
+
+	if (path != SI5351_PATH_PLL) {
+		s->full++;
+		return;
+	}
+
+	/* the integer-mode bit is in CLK6/7_CTRL, away from the block */
+	bad = mock->pll_resets != s->resets ||
+	      xfers > ((mode == BENCH_VCXO) ? 1 : 2) + mock->written[SI5351_CLK6_CTRL + pll];
+	for (reg = 0; reg < SI5351_REG_COUNT; reg++)
+		if (mock->written[reg] && reg != SI5351_CLK6_CTRL + pll &&
+		    (reg < base || reg >= base + SI5351_PARAMETERS_LENGTH))
+			bad = true;
+
+	s->pll++;
+	if (bad)
+		s->bad++;
+	s->max_xfers = max(s->max_xfers, xfers);
+	s->max_bytes = max(s->max_bytes, bytes);
+}
+
+/* what si5351_read_ext() does for a "frequency" read, timed until stopped */
+static void *bench_reader_run(void *arg)
+{
+	struct bench_reader *r = arg;
+	unsigned int freq, phase;
+	char buf[16];
+	ktime_t t0;
+	s64 ns;
+
+	while (!__atomic_load_n(&bench_stop, __ATOMIC_RELAXED)) {
+		t0 = ktime_get();
+		si5351_read_caches(r->st, r->output, &freq, &phase);
+		sprintf(buf, "%u\n", freq);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+		r->hist[min_t(s64, ns >> BENCH_LAT_SHIFT, BENCH_LAT_BUCKETS - 1)]++;
+		if (ns > r->max)
+			r->max = ns;
+		r->reads++;
+	}
+
+	return NULL;
+}
+
+static int bench_readers_start(struct bench_reader *readers, unsigned int count,
+			       struct si5351_state *st, unsigned int output)
+{
+	unsigned int i;
+
+	__atomic_store_n(&bench_stop, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < count; i++) {
+		memset(&readers[i], 0, sizeof(readers[i]));
+		readers[i].st = st;
+		readers[i].output = output;
+		if (pthread_create(&readers[i].thread, NULL, bench_reader_run, &readers[i])) {
+			__atomic_store_n(&bench_stop, 1, __ATOMIC_RELAXED);
+			while (i--)
+				pthread_join(readers[i].thread, NULL);
+			return -EAGAIN;
+		}
+	}
+
+	return 0;
+}
+
+/* stop the readers and print their merged latency percentiles */
+static void bench_readers_report(struct bench_reader *readers, unsigned int count, const char *what)
+{
+	static const unsigned int permille[] = { 500, 990, 999 };
+	unsigned long long reads = 0, seen, hist;
+	unsigned int i, p, b;
+	s64 max = 0;
+
+	__atomic_store_n(&bench_stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < count; i++) {
+		pthread_join(readers[i].thread, NULL);
+		reads += readers[i].reads;
+		max = max(max, readers[i].max);
+	}
+	if (!reads)
+		return;
+
+	printf("reads %-5s %llu,", what, reads);
+	for (p = 0, b = 0, seen = 0; p < ARRAY_SIZE(permille); p++) {
+		for (; b < BENCH_LAT_BUCKETS; b++) {
+			for (hist = 0, i = 0; i < count; i++)
+				hist += readers[i].hist[b];
+			if ((seen + hist) * 1000 >= reads * permille[p])
+				break;
+			seen += hist;
+		}
+		printf(" p%g %d ns,", permille[p] / 10.0, (b + 1) << BENCH_LAT_SHIFT);
+	}
+	printf(" max %lld ns\n", max);
+}
+
+/* "f1,f2,..." or "start:stop:step" in Hz */
+static unsigned int *bench_parse_freqs(const char *arg, unsigned int *count)
+{
+	unsigned int start, stop, step, n = 0, size = 16;
+	unsigned int *freqs;
+	char *list, *token, *p;
+
+	freqs = malloc(size * sizeof(*freqs));
+	if (!freqs)
+		return NULL;
+
+	if (sscanf(arg, "%u:%u:%u", &start, &stop, &step) == 3) {
+		if (!step || stop < start)
+			goto err;
+		for (; start <= stop; start += step) {
+			if (n == size) {
+				size *= 2;
+				freqs = realloc(freqs, size * sizeof(*freqs));
+				if (!freqs)
+					return NULL;
+			}
+			freqs[n++] = start;
+			if (stop - start < step)
+				break;
+		}
+	} else {
+		list = strdup(arg);
+		for (p = list; (token = strsep(&p, ",")) != NULL; ) {
+			if (!*token)
+				continue;
+			if (n == size) {
+				size *= 2;
+				freqs = realloc(freqs, size * sizeof(*freqs));
+				if (!freqs)
+					return NULL;
+			}
+			if (kstrtouint(token, 10, &freqs[n++])) {
+				free(list);
+				goto err;
+			}
+		}
+		free(list);
+	}
+
+	if (!n)
+		goto err;
+	*count = n;
+	return freqs;
+
+err:
+	free(freqs);
+	return NULL;
+}
+
+/* the per-mode setup of an output before it is tuned */
+static int bench_prepare(const struct bench_config *cfg, struct si5351_state *st, unsigned int output)
+{
+	unsigned int group_phase[SI5351_MAX_CHANNELS] = { 0, 90 };
+
+	switch (cfg->mode) {
+	case BENCH_FINE:
+		set_bit(output, &st->fine_mask);
+		return 0;
+	case BENCH_VCXO:
+		si5351_vcxo_setup(st, NULL);
+		return si5351_commit(st);
+	case BENCH_GROUP:
+		return si5351_group_set(st, 0, BIT(0) | BIT(1), group_phase);
+	default:
+		return 0;
+	}
+}
+
+static void bench_report(const struct bench_config *cfg, const struct si5351_mock *mock,
+			 const struct bench_timing *timing, unsigned long long ok, unsigned long long failed,
+			 ktime_t elapsed)
+{
+	double secs = ktime_to_ns(elapsed) / 1e9;
+	unsigned int i;
+
+	printf("mode %s, output %u, %u frequencies x %u passes, %s bus, tune cache %u\n",
+	       bench_modes[cfg->mode], cfg->output, cfg->count, cfg->passes,
+	       cfg->smbus ? "SMBus" : "I2C", cfg->cache_size);
+	printf("tunes       %llu ok, %llu failed in %.3f s, %.0f tunes/s\n",
+	       ok, failed, secs, secs > 0 ? (ok + failed) / secs : 0.0);
+	if (!ok)
+		return;
+
+	printf("i2c reads   %.2f transfers, %.2f bytes per tune\n",
+	       (double)mock->read_xfers / ok, (double)mock->read_bytes / ok);
+	printf("i2c writes  %.2f transfers, %.2f bytes per tune\n",
+	       (double)mock->write_xfers / ok, (double)mock->write_bytes / ok);
+	printf("pll resets  %.2f per tune\n", (double)mock->pll_resets / ok);
+	for (i = 0; i < BENCH_PHASES; i++)
+		printf("%-11s mean %lld ns, min %lld ns, max %lld ns\n", bench_phase_names[i],
+		       timing[i].sum / (s64)ok, timing[i].min, timing[i].max);
+}
+
+/*
+ * 100000001 Hz has no exact quadrature PLL ratio for any divider in reach
+ * from a 25 MHz crystal. The replan must still leave an integer divider,
+ * so that the next small step only moves the PLL.
+ */
+static int bench_fine_replan(struct si5351_state *st, unsigned int output)
+{
+	struct bench_timing t[BENCH_PHASES] = { { 0 } };
+	unsigned int path;
+
+	if (bench_tune(st, BENCH_FINE, output, 100000001, 0, t, &path) < 0 ||
+	    path != SI5351_PATH_REPLAN)
+		return -EINVAL;
+	if (bench_tune(st, BENCH_FINE, output, 100000003, 0, t, &path) < 0 ||
+	    path != SI5351_PATH_PLL)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Solve cost of the exact engine against the integer Hz solver, for the
+ * same targets against the same VCO. Only the solve is timed, nothing is
+ * staged, and the solution cache is bypassed.
+ */
+static void bench_exact_cost(const struct bench_config *cfg, struct si5351_state *st)
+{
+	unsigned int kind = (cfg->output >= 6) ? SI5351_SOLVE_MSYNTH67 : SI5351_SOLVE_MSYNTH;
+	struct bench_timing exact = { 0 }, integer = { 0 };
+	struct si5351_tune_solution sol;
+	unsigned int pll, plls, pass, i;
+	ktime_t t0;
+	u64 fout;
+	s64 n;
+
+	plls = si5351_lock_plls(st, BIT(cfg->output));
+	pll = si5351_output_pll(st, cfg->output);
+	for (pass = 0; pass < cfg->passes; pass++) {
+		for (i = 0; i < cfg->count; i++) {
+			t0 = ktime_get();
+			si5351_solve_exact(st, cfg->output, pll, (u64)cfg->freqs[i] * 1000,
+					   cfg->phase % 180, &sol, &fout);
+			bench_time(&exact, t0, ktime_get());
+			t0 = ktime_get();
+			si5351_solve_direct(st, kind, st->fVCO[pll], cfg->freqs[i], cfg->phase % 180, &sol);
+			bench_time(&integer, t0, ktime_get());
+		}
+	}
+	si5351_unlock_plls(st, plls);
+
+	n = (s64)cfg->passes * cfg->count;
+	printf("solve cost  exact mean %lld ns, integer Hz mean %lld ns, x%.2f\n",
+	       exact.sum / n, integer.sum / n, integer.sum ? (double)exact.sum / integer.sum : 0.0);
+}
+
+/* one output of one chip, timed tune by tune, with optional readers */
+static int bench_single(const struct bench_config *cfg)
+{
+	struct bench_timing timing[BENCH_PHASES] = { { 0 } };
+	bool check = cfg->mode == BENCH_FINE || cfg->mode == BENCH_VCXO;
+	unsigned long long ok = 0, failed = 0;
+	struct bench_reader *readers = NULL;
+	struct bench_steps steps = { 0 };
+	unsigned int pass, i, path;
+	u64 fout;
+	struct si5351_mock mock;
+	struct si5351_state *st;
+	struct timespec ts;
+	ktime_t start, end;
+	int ret;
+
+	si5351_mock_init(&mock, "bench", cfg->bus_khz);
+	st = bench_setup(cfg, &mock);
+	if (!st) {
+		fprintf(stderr, "setting up the mock chip failed\n");
+		return 1;
+	}
+	ret = bench_prepare(cfg, st, cfg->output);
+	if (ret < 0) {
+		fprintf(stderr, "setting up mode %s failed: %d\n", bench_modes[cfg->mode], ret);
+		free(st);
+		return 1;
+	}
+	/* multisynth 6 reads a = 0 until it is tuned */
+	if (cfg->mode == BENCH_EXACT && si5351_exact_rate(st, 6, &fout) != -ENODATA) {
+		fprintf(stderr, "exact rate of untuned output 6 did not fail with -ENODATA\n");
+		free(st);
+		return 1;
+	}
+	if (cfg->mode == BENCH_FINE && bench_fine_replan(st, cfg->output) < 0) {
+		fprintf(stderr, "a fine step after an inexact replan did not take the PLL-only path\n");
+		free(st);
+		return 1;
+	}
+	si5351_mock_clear_counters(&mock);
+
+	if (cfg->readers) {
+		readers = calloc(cfg->readers, sizeof(*readers));
+		if (!readers || bench_readers_start(readers, cfg->readers, st, cfg->output) < 0) {
+			fprintf(stderr, "starting %u reader threads failed\n", cfg->readers);
+			free(readers);
+			free(st);
+			return 1;
+		}
+	}
+
+	start = ktime_get();
+	for (pass = 0; pass < cfg->passes; pass++) {
+		for (i = 0; i < cfg->count; i++) {
+			if (check)
+				bench_step_begin(&steps, &mock);
+			if (bench_tune(st, cfg->mode, cfg->output, cfg->freqs[i], cfg->phase, timing, &path)) {
+				failed++;
+				continue;
+			}
+			ok++;
+			if (check)
+				bench_step_end(&steps, &mock, cfg->mode, si5351_output_pll(st, cfg->output), path);
+		}
+	}
+	end = ktime_get();
+
+	if (cfg->readers)
+		bench_readers_report(readers, cfg->readers, "tune");
+	bench_report(cfg, &mock, timing, ok, failed, ktime_sub(end, start));
+	if (check) {
+		printf("steps       %llu PLL only, %llu full, %llu failed the check\n",
+		       steps.pll, steps.full, steps.bad);
+		if (steps.pll)
+			printf("PLL steps   at most %llu transfers, %llu bytes\n",
+			       steps.max_xfers, steps.max_bytes);
+		ret = steps.bad ? 1 : 0;
+	}
+
+	/* the same readers for as long again, without any retune */
+	if (cfg->readers && bench_readers_start(readers, cfg->readers, st, cfg->output) == 0) {
+		ts.tv_sec = (end - start) / NSEC_PER_SEC;
+		ts.tv_nsec = (end - start) % NSEC_PER_SEC;
+		nanosleep(&ts, NULL);
+		bench_readers_report(readers, cfg->readers, "idle");
+	}
+	if (cfg->mode == BENCH_EXACT)
+		bench_exact_cost(cfg, st);
+
+	free(readers);
+	free(st);
+
+	return ret;
+}
+
+static void *bench_worker_run(void *arg)
+{
+	struct bench_worker *w = arg;
+	unsigned int pass, i;
+
+	for (pass = 0; pass < w->cfg->passes; pass++) {
+		for (i = 0; i < w->cfg->count; i++) {
+			if (bench_tune(w->st, w->cfg->mode, w->output, w->cfg->freqs[i],
+				       w->cfg->phase, w->timing, NULL) == 0)
+				w->ok++;
+			else
+				w->failed++;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Scaling: 1 to cfg->threads tuning threads, spread round robin over
+ * cfg->chips chips. On each chip the threads take outputs 0, 1, 2, ...,
+ * and the odd ones run from PLL_B, so two threads on one chip solve in
+ * separate PLL domains and only meet at the bus lock. Every thread runs
+ * the full frequency set, so a perfect scaling keeps the time constant.
+ */
+static int bench_scaling(const struct bench_config *cfg)
+{
+	struct si5351_mock *mocks;
+	struct si5351_state **states;
+	struct bench_worker *workers;
+	unsigned long long ok, failed;
+	unsigned int threads, chip, i;
+	double secs, base = 0;
+	char (*names)[16];
+	ktime_t start;
+	int ret = 1;
+
+	mocks = calloc(cfg->chips, sizeof(*mocks));
+	states = calloc(cfg->chips, sizeof(*states));
+	workers = calloc(cfg->threads, sizeof(*workers));
+	names = calloc(cfg->chips, sizeof(*names));
+	if (!mocks || !states || !workers || !names)
+		goto out;
+
+	printf("mode %s, %u frequencies x %u passes per thread, %u chip%s, %s bus%s\n",
+	       bench_modes[cfg->mode], cfg->count, cfg->passes, cfg->chips, (cfg->chips > 1) ? "s" : "",
+	       cfg->smbus ? "SMBus" : "I2C", cfg->bus_khz ? "" : ", no bus time");
+
+	for (threads = 1; threads <= cfg->threads; threads++) {
+		for (chip = 0; chip < cfg->chips; chip++) {
+			snprintf(names[chip], sizeof(names[chip]), "bench%u", chip);
+			si5351_mock_init(&mocks[chip], names[chip], cfg->bus_khz);
+			states[chip] = bench_setup(cfg, &mocks[chip]);
+			if (!states[chip] || bench_split_plls(states[chip]) < 0) {
+				fprintf(stderr, "setting up mock chip %u failed\n", chip);
+				goto out_states;
+			}
+		}
+
+		memset(workers, 0, threads * sizeof(*workers));
+		for (i = 0; i < threads; i++) {
+			workers[i].cfg = cfg;
+			workers[i].st = states[i % cfg->chips];
+			workers[i].output = i / cfg->chips;
+			if (bench_prepare(cfg, workers[i].st, workers[i].output) < 0) {
+				fprintf(stderr, "setting up mode %s failed\n", bench_modes[cfg->mode]);
+				goto out_states;
+			}
+		}
+
+		start = ktime_get();
+		for (i = 0; i < threads; i++) {
+			if (pthread_create(&workers[i].thread, NULL, bench_worker_run, &workers[i])) {
+				fprintf(stderr, "starting tuning thread %u failed\n", i);
+				while (i--)
+					pthread_join(workers[i].thread, NULL);
+				goto out_states;
+			}
+		}
+		for (ok = 0, failed = 0, i = 0; i < threads; i++) {
+			pthread_join(workers[i].thread, NULL);
+			ok += workers[i].ok;
+			failed += workers[i].failed;
+		}
+		secs = ktime_to_ns(ktime_sub(ktime_get(), start)) / 1e9;
+
+		if (threads == 1)
+			base = ok / secs;
+		printf("threads %2u  %llu ok, %llu failed in %.3f s, %.0f tunes/s, x%.2f\n",
+		       threads, ok, failed, secs, ok / secs, base > 0 ? ok / secs / base : 0.0);
+
+		for (chip = 0; chip < cfg->chips; chip++) {
+			free(states[chip]);
+			states[chip] = NULL;
+		}
+	}
+	ret = 0;
+
+out_states:
+	for (chip = 0; chip < cfg->chips; chip++)
+		free(states[chip]);
+out:
+	free(names);
+	free(workers);
+	free(states);
+	free(mocks);
+
+	return ret;
+}
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -f FREQS   frequencies in Hz, \"f1,f2,...\" or \"start:stop:step\"\n"
+		"             (default 1000000:150000000:99991)\n"
+		"             in vcxo mode, offsets in ppb (default 0:100000:97)\n"
+		"  -m MODE    msynth (default), fine, group, exact or vcxo\n"
+		"  -c OUTPUT  output to tune (default 0, output group 0 in group mode)\n"
+		"  -p PHASE   phase in degrees (default 0)\n"
+		"  -n PASSES  passes over the frequency set (default 10)\n"
+		"  -C SIZE    tuning solution cache size (default 0, off)\n"
+		"  -x XTAL    crystal frequency in Hz (default %u)\n"
+		"  -s         SMBus-only adapter instead of plain I2C\n"
+		"  -k KHZ     I2C clock, transfers take their wire time (default 0, none)\n"
+		"  -R READERS reader threads polling the output during and after the run\n"
+		"  -t THREADS scaling run with 1 to THREADS tuning threads\n"
+		"  -d CHIPS   chips the scaling run spreads its threads over (default 1)\n",
+		prog, DEFAULT_XTAL_RATE);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_config cfg = {
+		.mode = BENCH_MSYNTH,
+		.passes = 10,
+		.xtal = DEFAULT_XTAL_RATE,
+		.chips = 1,
+	};
+	const char *freq_arg = NULL;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "f:m:c:p:n:C:x:sk:R:t:d:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			freq_arg = optarg;
+			break;
+		case 'm':
+			for (cfg.mode = 0; cfg.mode < ARRAY_SIZE(bench_modes); cfg.mode++)
+				if (!strcmp(optarg, bench_modes[cfg.mode]))
+					break;
+			if (cfg.mode == ARRAY_SIZE(bench_modes)) {
+				bench_usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'c':
+			cfg.output = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg.phase = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			cfg.passes = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			cfg.cache_size = min_t(unsigned int, strtoul(optarg, NULL, 0), SI5351_TUNE_CACHE_MAX);
+			break;
+		case 'x':
+			cfg.xtal = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			cfg.smbus = true;
+			break;
+		case 'k':
+			cfg.bus_khz = strtoul(optarg, NULL, 0);
+			break;
+		case 'R':
+			cfg.readers = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg.threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg.chips = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			bench_usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (!freq_arg)
+		freq_arg = (cfg.mode == BENCH_VCXO) ? "0:100000:97" : "1000000:150000000:99991";
+	cfg.freqs = bench_parse_freqs(freq_arg, &cfg.count);
+	if (!cfg.freqs || !cfg.passes || cfg.output >= SI5351_MAX_CHANNELS || cfg.phase >= 360 ||
+	    !cfg.chips) {
+		bench_usage(argv[0]);
+		return 1;
+	}
+	if (cfg.mode == BENCH_GROUP) {
+		cfg.output = 0;
+		cfg.phase = 0;
+	}
+
+	/* outputs 6 and 7 are integer only, the scaling run stays on 0..5 */
+	if (cfg.threads) {
+		if (cfg.mode == BENCH_GROUP || cfg.mode == BENCH_VCXO || cfg.threads > 6 * cfg.chips) {
+			fprintf(stderr, "the scaling run needs a mode other than group or vcxo and at most 6 threads per chip\n");
+			return 1;
+		}
+		ret = bench_scaling(&cfg);
+	} else {
+		ret = bench_single(&cfg);
+	}
+
+	free(cfg.freqs);
+
+	return ret;
+}
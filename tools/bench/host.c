@@ -0,0 +1,255 @@
+/*
+ * host.c: userspace versions of the kernel library calls used by si5351-iio.c
+ *
+ * Licensed under the GPL-2.
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+
+#include "host.h"
+
+/*
+ * Same continued fraction walk as lib/math/rational.c: stop at the first
+ * convergent that exceeds a limit and take the best semiconvergent before
+ * it, so the solvers see exactly the values they get in the kernel.
+ */
+void rational_best_approximation(unsigned long given_numerator, unsigned long given_denominator,
+				 unsigned long max_numerator, unsigned long max_denominator,
+				 unsigned long *best_numerator, unsigned long *best_denominator)
+{
+	unsigned long n, d, n0, d0, n1, d1, n2, d2;
+
+	n = given_numerator;
+	d = given_denominator;
+	n0 = d1 = 0;
+	n1 = d0 = 1;
+
+	for (;;) {
+		unsigned long dp, a;
+
+		if (d == 0)
+			break;
+		dp = d;
+		a = n / d;
+		d = n % d;
+		n = dp;
+
+		n2 = n0 + a * n1;
+		d2 = d0 + a * d1;
+
+		if (n2 > max_numerator || d2 > max_denominator) {
+			unsigned long t = ULONG_MAX;
+
+			if (d1)
+				t = (max_denominator - d0) / d1;
+			if (n1)
+				t = min(t, (max_numerator - n0) / n1);
+
+			/* the semiconvergent is only better if t is at least half of a */
+			if (!d1 || 2u * t > a || (2u * t == a && d0 * dp > d1 * d)) {
+				n1 = n0 + t * n1;
+				d1 = d0 + t * d1;
+			}
+			break;
+		}
+		n0 = n1;
+		n1 = n2;
+		d0 = d1;
+		d1 = d2;
+	}
+
+	*best_numerator = n1;
+	*best_denominator = d1;
+}
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	if (!size)
+		return 0;
+
+	va_start(args, fmt);
+	len = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+
+	if (len < 0)
+		return 0;
+	return ((size_t)len >= size) ? (int)size - 1 : len;
+}
+
+char *devm_kasprintf(struct device *dev, int gfp, const char *fmt, ...)
+{
+	va_list args;
+	char *buf;
+
+	va_start(args, fmt);
+	if (vasprintf(&buf, fmt, args) < 0)
+		buf = NULL;
+	va_end(args);
+
+	return buf;
+}
+
+char *skip_spaces(const char *s)
+{
+	while (isspace((unsigned char)*s))
+		s++;
+	return (char *)s;
+}
+
+char *strim(char *s)
+{
+	size_t len = strlen(s);
+
+	while (len && isspace((unsigned char)s[len - 1]))
+		s[--len] = '\0';
+	return skip_spaces(s);
+}
+
+bool sysfs_streq(const char *a, const char *b)
+{
+	while (*a && *a == *b) {
+		a++;
+		b++;
+	}
+	if (*a == *b)
+		return true;
+	if (!*a && *b == '\n' && !b[1])
+		return true;
+	if (*a == '\n' && !a[1] && !*b)
+		return true;
+	return false;
+}
+
+/* kstrto*(): the whole string must be a number, a single trailing newline is allowed */
+static int host_strtoull(const char *s, unsigned int base, unsigned long long *res)
+{
+	char *end;
+
+	if (*s == '+')
+		s++;
+	if (!isxdigit((unsigned char)*s))
+		return -EINVAL;
+
+	errno = 0;
+	*res = strtoull(s, &end, base);
+	if (errno)
+		return -ERANGE;
+	if (*end == '\n')
+		end++;
+	return *end ? -EINVAL : 0;
+}
+
+int kstrtoull(const char *s, unsigned int base, unsigned long long *res)
+{
+	return host_strtoull(s, base, res);
+}
+
+int kstrtoll(const char *s, unsigned int base, long long *res)
+{
+	unsigned long long val;
+	int ret;
+
+	if (*s == '-') {
+		ret = host_strtoull(s + 1, base, &val);
+		if (ret)
+			return ret;
+		if (val > (unsigned long long)LLONG_MAX + 1)
+			return -ERANGE;
+		*res = -(long long)val;
+		return 0;
+	}
+
+	ret = host_strtoull(s, base, &val);
+	if (ret)
+		return ret;
+	if (val > LLONG_MAX)
+		return -ERANGE;
+	*res = val;
+	return 0;
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+	unsigned long long val;
+	int ret;
+
+	ret = kstrtoull(s, base, &val);
+	if (ret)
+		return ret;
+	if (val > UINT_MAX)
+		return -ERANGE;
+	*res = val;
+	return 0;
+}
+
+int kstrtoint(const char *s, unsigned int base, int *res)
+{
+	long long val;
+	int ret;
+
+	ret = kstrtoll(s, base, &val);
+	if (ret)
+		return ret;
+	if (val < INT_MIN || val > INT_MAX)
+		return -ERANGE;
+	*res = val;
+	return 0;
+}
+
+int kstrtobool(const char *s, bool *res)
+{
+	switch (s[0]) {
+	case 'y': case 'Y': case '1':
+		*res = true;
+		return 0;
+	case 'n': case 'N': case '0':
+		*res = false;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* "<integer>[.<fraction>]" with fract_mult scaling the first fractional digit */
+int iio_str_to_fixpoint(const char *str, int fract_mult, int *integer, int *fract)
+{
+	int i = 0, f = 0;
+	bool negative = false, point = false;
+
+	if (*str == '-') {
+		negative = true;
+		str++;
+	}
+
+	for (; *str; str++) {
+		if (*str == '\n' && !str[1])
+			break;
+		if (*str == '.' && !point) {
+			point = true;
+			continue;
+		}
+		if (!isdigit((unsigned char)*str))
+			return -EINVAL;
+		if (!point)
+			i = i * 10 + *str - '0';
+		else if (fract_mult) {
+			f += fract_mult * (*str - '0');
+			fract_mult /= 10;
+		}
+	}
+
+	if (negative) {
+		if (i)
+			i = -i;
+		else
+			f = -f;
+	}
+	*integer = i;
+	*fract = f;
+
+	return 0;
+}
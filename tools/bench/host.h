@@ -0,0 +1,424 @@
+/*
+ * host.h: just enough of the kernel API to build si5351-iio.c in userspace
+ *
+ * Licensed under the GPL-2.
+ *
+ * Every kernel header the driver includes is generated by the Makefile as a
+ * one-line stub that includes this file. The arithmetic (do_div, the 64 bit
+ * division helpers, rational_best_approximation in host.c) behaves like the
+ * kernel's, locks are pthread mutexes so the driver can be driven from
+ * several threads, and everything that needs a real device (I2C adapter,
+ * IIO core, misc device, debugfs, timers) is a stub that fails or does
+ * nothing. The bus itself is replaced through st->bus, see mock.c.
+ */
+
+#ifndef _SI5351_HOST_H
+#define _SI5351_HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef uint32_t __u32;
+typedef unsigned long long __u64;
+typedef unsigned short umode_t;
+
+#define __init
+#define __exit
+#define __user
+#define ____cacheline_aligned __attribute__((aligned(64)))
+
+#define KERN_INFO ""
+#define KERN_ERR ""
+#define printk(...) printf(__VA_ARGS__)
+
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_LICENSE(x)
+#define MODULE_DEVICE_TABLE(type, name)
+#define module_init(fn) int (*host_module_init)(void) = fn
+#define module_exit(fn) void (*host_module_exit)(void) = fn
+#define THIS_MODULE ((struct module *)0)
+
+#define IS_ENABLED(option) 0
+#define PAGE_SIZE 4096
+#define BITS_PER_LONG (8 * sizeof(long))
+
+/* arithmetic */
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BIT(n) (1UL << (n))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b) ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp(v, l, h) min(max(v, l), h)
+#define clamp_t(t, v, l, h) min_t(t, max_t(t, v, l), h)
+#define abs(x) ((x) < 0 ? -(x) : (x))
+#define round_up(x, y) ((((x) - 1) | ((y) - 1)) + 1)
+#define DIV_ROUND_UP(x, d) (((x) + (d) - 1) / (d))
+#define DIV_ROUND_CLOSEST(x, d) (((x) + ((d) / 2)) / (d))
+#define DIV_ROUND_CLOSEST_ULL(x, d) ({ u64 _x = (x); u32 _d = (d); (_x + _d / 2) / _d; })
+#define do_div(n, base) ({ u32 __base = (base); u32 __rem = (n) % __base; (n) /= __base; __rem; })
+
+static inline u64 div_u64(u64 a, u32 b) { return a / b; }
+static inline u64 div_u64_rem(u64 a, u32 b, u32 *r) { *r = a % b; return a / b; }
+static inline u64 div64_u64(u64 a, u64 b) { return a / b; }
+static inline u64 div64_u64_rem(u64 a, u64 b, u64 *r) { *r = a % b; return a / b; }
+static inline s64 div_s64(s64 a, s32 b) { return a / b; }
+static inline s64 div64_s64(s64 a, s64 b) { return a / b; }
+static inline u64 mul_u32_u32(u32 a, u32 b) { return (u64)a * b; }
+static inline u64 mul_u64_u64_div_u64(u64 a, u64 b, u64 c) { return (u64)((unsigned __int128)a * b / c); }
+static inline unsigned long gcd(unsigned long a, unsigned long b)
+{
+	while (b) {
+		unsigned long t = a % b;
+
+		a = b;
+		b = t;
+	}
+	return a;
+}
+void rational_best_approximation(unsigned long given_numerator, unsigned long given_denominator,
+				 unsigned long max_numerator, unsigned long max_denominator,
+				 unsigned long *best_numerator, unsigned long *best_denominator);
+
+/* bit operations */
+static inline int fls(unsigned int x) { return x ? 32 - __builtin_clz(x) : 0; }
+static inline int fls64(u64 x) { return x ? 64 - __builtin_clzll(x) : 0; }
+static inline int ilog2(u64 x) { return fls64(x) - 1; }
+#define __ffs(x) ((unsigned long)__builtin_ctzl(x))
+#define hweight_long(x) __builtin_popcountl(x)
+#define test_bit(nr, addr) ((int)((*(addr) >> (nr)) & 1))
+#define set_bit(nr, addr) (*(addr) |= 1UL << (nr))
+#define clear_bit(nr, addr) (*(addr) &= ~(1UL << (nr)))
+static inline unsigned long host_next_bit(const unsigned long *addr, unsigned long size, unsigned long bit)
+{
+	for (; bit < size; bit++)
+		if ((addr[bit / BITS_PER_LONG] >> (bit % BITS_PER_LONG)) & 1)
+			break;
+	return bit;
+}
+#define for_each_set_bit(bit, addr, size) \
+	for ((bit) = host_next_bit((addr), (size), 0); (bit) < (size); \
+	     (bit) = host_next_bit((addr), (size), (bit) + 1))
+
+#define likely(x) (x)
+#define unlikely(x) (x)
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* strings */
+int scnprintf(char *buf, size_t size, const char *fmt, ...);
+char *skip_spaces(const char *s);
+char *strim(char *s);
+bool sysfs_streq(const char *a, const char *b);
+int kstrtoull(const char *s, unsigned int base, unsigned long long *res);
+int kstrtoll(const char *s, unsigned int base, long long *res);
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+int kstrtoint(const char *s, unsigned int base, int *res);
+int kstrtobool(const char *s, bool *res);
+#define kstrtou32 kstrtouint
+#define kstrtos32 kstrtoint
+#define kstrtou64 kstrtoull
+#define kstrtos64 kstrtoll
+
+/* memory */
+#define GFP_KERNEL 0
+#define kmalloc(n, gfp) malloc(n)
+#define kzalloc(n, gfp) calloc(1, n)
+#define kcalloc(a, n, gfp) calloc(a, n)
+#define kmalloc_array(a, n, gfp) malloc((a) * (n))
+#define kvcalloc(a, n, gfp) calloc(a, n)
+#define kfree(p) free((void *)(p))
+#define kvfree(p) free((void *)(p))
+#define kstrndup(s, n, gfp) strndup(s, n)
+#define PTR_ERR(p) ((long)(p))
+#define ERR_PTR(e) ((void *)(long)(e))
+#define IS_ERR(p) ((unsigned long)(p) > (unsigned long)-4096)
+#define IS_ERR_OR_NULL(p) (!(p) || IS_ERR(p))
+
+/* devices */
+struct module;
+struct device_node;
+struct kobject { int unused; };
+struct device {
+	struct device *parent;
+	struct device_node *of_node;
+	struct kobject kobj;
+	void *driver_data;
+	const char *init_name;
+};
+static inline const char *dev_name(const struct device *dev) { return dev->init_name; }
+static inline void *dev_get_drvdata(const struct device *dev) { return dev->driver_data; }
+static inline void dev_set_drvdata(struct device *dev, void *data) { dev->driver_data = data; }
+#define devm_kzalloc(dev, n, gfp) calloc(1, n)
+#define devm_kcalloc(dev, a, n, gfp) calloc(a, n)
+char *devm_kasprintf(struct device *dev, int gfp, const char *fmt, ...);
+#define dev_dbg(dev, ...) ((void)(dev))
+#define dev_info(dev, ...) ((void)(dev))
+#define dev_warn(dev, ...) ((void)(dev))
+#define dev_err(dev, ...) ((void)(dev))
+#define dev_err_ratelimited(dev, ...) ((void)(dev))
+
+struct attribute { const char *name; umode_t mode; };
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *, struct device_attribute *, char *);
+	ssize_t (*store)(struct device *, struct device_attribute *, const char *, size_t);
+};
+struct attribute_group { const char *name; struct attribute **attrs; };
+static inline void sysfs_notify(struct kobject *kobj, const char *dir, const char *attr) { }
+#define S_IRUGO 0444
+#define S_IWUSR 0200
+
+static inline int of_property_read_string(const struct device_node *np, const char *name, const char **val) { return -EINVAL; }
+static inline int of_property_read_u32(const struct device_node *np, const char *name, u32 *val) { return -EINVAL; }
+static inline int of_property_read_u32_array(const struct device_node *np, const char *name, u32 *val, size_t n) { return -EINVAL; }
+static inline int of_property_count_u32_elems(const struct device_node *np, const char *name) { return -EINVAL; }
+static inline bool of_property_read_bool(const struct device_node *np, const char *name) { return false; }
+struct of_device_id { const char *compatible; const void *data; };
+
+/*
+ * Locking. The threaded benchmark modes run the driver's locks for real:
+ * mutexes and spinlocks are pthread mutexes, and the seqcount is the
+ * kernel's, an even/odd sequence with the matching barriers.
+ */
+struct mutex { pthread_mutex_t m; };
+#define mutex_init(l) pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l) pthread_mutex_lock(&(l)->m)
+#define mutex_lock_nested(l, sub) pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l) pthread_mutex_unlock(&(l)->m)
+#define SINGLE_DEPTH_NESTING 1
+typedef struct mutex spinlock_t;
+#define spin_lock_init(l) mutex_init(l)
+#define spin_lock(l) mutex_lock(l)
+#define spin_unlock(l) mutex_unlock(l)
+typedef struct { unsigned int sequence; } seqcount_mutex_t;
+#define seqcount_mutex_init(s, l) ((s)->sequence = 0)
+static inline void write_seqcount_begin(seqcount_mutex_t *s)
+{
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+static inline void write_seqcount_end(seqcount_mutex_t *s)
+{
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+static inline unsigned int read_seqcount_begin(const seqcount_mutex_t *s)
+{
+	unsigned int seq;
+
+	while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1)
+		;
+	return seq;
+}
+static inline int read_seqcount_retry(const seqcount_mutex_t *s, unsigned int seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+/* time */
+typedef s64 ktime_t;
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_SEC 1000000000L
+#define USEC_PER_SEC 1000000L
+static inline s64 ktime_to_ns(ktime_t t) { return t; }
+static inline s64 ktime_to_us(ktime_t t) { return t / 1000; }
+static inline ktime_t ns_to_ktime(u64 ns) { return ns; }
+static inline ktime_t us_to_ktime(u64 us) { return us * 1000; }
+static inline ktime_t ktime_add(ktime_t a, ktime_t b) { return a + b; }
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) { return a - b; }
+static inline s64 ktime_us_delta(ktime_t a, ktime_t b) { return (a - b) / 1000; }
+#define usleep_range(min, max) ((void)0)
+
+enum hrtimer_restart { HRTIMER_NORESTART, HRTIMER_RESTART };
+enum hrtimer_mode { HRTIMER_MODE_REL, HRTIMER_MODE_ABS };
+struct hrtimer { enum hrtimer_restart (*function)(struct hrtimer *); };
+static inline void hrtimer_init(struct hrtimer *t, clockid_t clock, enum hrtimer_mode mode) { }
+static inline void hrtimer_start(struct hrtimer *t, ktime_t time, enum hrtimer_mode mode) { }
+static inline int hrtimer_cancel(struct hrtimer *t) { return 0; }
+static inline u64 hrtimer_forward_now(struct hrtimer *t, ktime_t interval) { return 1; }
+static inline ktime_t hrtimer_get_expires(const struct hrtimer *t) { return 0; }
+
+struct work_struct { int unused; };
+struct workqueue_struct;
+#define WQ_HIGHPRI 0
+#define INIT_WORK(w, fn) ((void)(fn))
+static inline bool queue_work(struct workqueue_struct *wq, struct work_struct *w) { return false; }
+static inline bool cancel_work_sync(struct work_struct *w) { return false; }
+static inline bool flush_work(struct work_struct *w) { return false; }
+static inline void flush_workqueue(struct workqueue_struct *wq) { }
+#define alloc_ordered_workqueue(fmt, flags, ...) ((struct workqueue_struct *)NULL)
+static inline void destroy_workqueue(struct workqueue_struct *wq) { }
+#define system_unbound_wq ((struct workqueue_struct *)NULL)
+
+/* I2C, only reached through si5351_i2c_bus and si5351_smbus_bus */
+struct i2c_adapter { int unused; };
+struct i2c_client { struct device dev; struct i2c_adapter *adapter; unsigned short addr; int irq; };
+struct i2c_device_id { const char *name; unsigned long driver_data; };
+struct i2c_msg { u16 addr; u16 flags; u16 len; u8 *buf; };
+#define I2C_FUNC_I2C 1
+#define I2C_FUNC_SMBUS_BYTE_DATA 2
+#define I2C_FUNC_SMBUS_READ_I2C_BLOCK 4
+#define I2C_SMBUS_BLOCK_MAX 32
+#define to_i2c_client(d) container_of(d, struct i2c_client, dev)
+static inline int i2c_check_functionality(struct i2c_adapter *adap, u32 func) { return 0; }
+static inline s32 i2c_smbus_read_byte_data(const struct i2c_client *c, u8 reg) { return -ENODEV; }
+static inline s32 i2c_smbus_write_byte_data(const struct i2c_client *c, u8 reg, u8 val) { return -ENODEV; }
+static inline s32 i2c_smbus_read_i2c_block_data(const struct i2c_client *c, u8 reg, u8 len, u8 *val) { return -ENODEV; }
+static inline s32 i2c_smbus_write_i2c_block_data(const struct i2c_client *c, u8 reg, u8 len, const u8 *val) { return -ENODEV; }
+static inline int i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num) { return -ENODEV; }
+struct i2c_driver {
+	struct { const char *name; const struct of_device_id *of_match_table; } driver;
+	int (*probe)(struct i2c_client *, const struct i2c_device_id *);
+	int (*remove)(struct i2c_client *);
+	const struct i2c_device_id *id_table;
+};
+static inline int i2c_add_driver(struct i2c_driver *drv) { return 0; }
+static inline void i2c_del_driver(struct i2c_driver *drv) { }
+
+/* IIO core, never registered on the host */
+struct iio_dev;
+struct iio_trigger;
+struct iio_buffer;
+enum iio_chan_type { IIO_VOLTAGE, IIO_ALTVOLTAGE, IIO_PHASE };
+enum iio_shared_by { IIO_SEPARATE, IIO_SHARED_BY_TYPE, IIO_SHARED_BY_DIR, IIO_SHARED_BY_ALL };
+enum iio_endian { IIO_CPU, IIO_BE, IIO_LE };
+struct iio_chan_spec;
+struct iio_chan_spec_ext_info {
+	const char *name;
+	enum iio_shared_by shared;
+	ssize_t (*read)(struct iio_dev *, uintptr_t, const struct iio_chan_spec *, char *);
+	ssize_t (*write)(struct iio_dev *, uintptr_t, const struct iio_chan_spec *, const char *, size_t);
+	uintptr_t private;
+};
+struct iio_scan_type { char sign; u8 realbits; u8 storagebits; u8 shift; enum iio_endian endianness; };
+struct iio_chan_spec {
+	enum iio_chan_type type;
+	int channel;
+	unsigned indexed:1;
+	unsigned output:1;
+	long info_mask_separate;
+	const struct iio_chan_spec_ext_info *ext_info;
+	int scan_index;
+	struct iio_scan_type scan_type;
+};
+struct iio_info { const struct attribute_group *attrs; };
+struct iio_dev {
+	struct device dev;
+	const char *name;
+	const struct iio_info *info;
+	int modes;
+	const struct iio_chan_spec *channels;
+	int num_channels;
+	unsigned long *active_scan_mask;
+	struct iio_buffer *buffer;
+	struct iio_trigger *trig;
+	int masklength;
+};
+#define INDIO_DIRECT_MODE 1
+#define dev_to_iio_dev(d) container_of(d, struct iio_dev, dev)
+static inline void *iio_priv(const struct iio_dev *indio_dev) { return (void *)(indio_dev + 1); }
+static inline struct iio_dev *devm_iio_device_alloc(struct device *dev, int sizeof_priv) { return NULL; }
+static inline int iio_device_register(struct iio_dev *indio_dev) { return -ENODEV; }
+static inline void iio_device_unregister(struct iio_dev *indio_dev) { }
+struct iio_dev_attr { struct device_attribute dev_attr; u64 address; };
+#define to_iio_dev_attr(a) container_of(a, struct iio_dev_attr, dev_attr)
+#define IIO_DEVICE_ATTR(_name, _mode, _show, _store, _addr) \
+	struct iio_dev_attr iio_dev_attr_##_name = { \
+		.dev_attr = { .attr = { .name = #_name, .mode = _mode }, .show = _show, .store = _store }, \
+		.address = _addr }
+struct iio_enum {
+	const char * const *items;
+	unsigned int num_items;
+	int (*set)(struct iio_dev *, const struct iio_chan_spec *, unsigned int);
+	int (*get)(struct iio_dev *, const struct iio_chan_spec *);
+};
+#define IIO_ENUM(_name, _shared, _e) { .name = (_name), .shared = (_shared), .private = (uintptr_t)(_e) }
+#define IIO_ENUM_AVAILABLE(_name, _shared, _e) { .name = (_name "_available"), .shared = (_shared), .private = (uintptr_t)(_e) }
+static inline ssize_t iio_enum_available_read(struct iio_dev *indio_dev, uintptr_t priv,
+					      const struct iio_chan_spec *chan, char *buf) { return 0; }
+int iio_str_to_fixpoint(const char *str, int fract_mult, int *integer, int *fract);
+typedef int irqreturn_t;
+#define IRQ_HANDLED 1
+struct iio_poll_func { struct iio_dev *indio_dev; s64 timestamp; };
+enum iio_buffer_direction { IIO_BUFFER_DIRECTION_IN, IIO_BUFFER_DIRECTION_OUT };
+struct iio_buffer_setup_ops { int (*preenable)(struct iio_dev *); };
+static inline int devm_iio_triggered_buffer_setup_ext(struct device *dev, struct iio_dev *indio_dev,
+						      irqreturn_t (*h)(int, void *), irqreturn_t (*thread)(int, void *),
+						      enum iio_buffer_direction direction,
+						      const struct iio_buffer_setup_ops *ops, const void **attrs)
+{
+	return -ENODEV;
+}
+static inline int iio_pop_from_buffer(struct iio_buffer *buffer, void *data) { return -ENODEV; }
+static inline void iio_trigger_notify_done(struct iio_trigger *trig) { }
+
+/* character device, debugfs */
+struct inode;
+struct file { void *private_data; };
+struct file_operations {
+	struct module *owner;
+	long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+	long (*compat_ioctl)(struct file *, unsigned int, unsigned long);
+	loff_t (*llseek)(struct file *, loff_t, int);
+	int (*open)(struct inode *, struct file *);
+	ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+	ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+	int (*release)(struct inode *, struct file *);
+};
+#define MISC_DYNAMIC_MINOR 255
+struct miscdevice { int minor; const char *name; const struct file_operations *fops; struct device *parent; };
+static inline int misc_register(struct miscdevice *misc) { return -ENODEV; }
+static inline void misc_deregister(struct miscdevice *misc) { }
+#define _IOWR(type, nr, arg) ((unsigned int)((3U << 30) | (sizeof(arg) << 16) | ((type) << 8) | (nr)))
+#define copy_from_user(to, from, n) (memcpy(to, from, n), 0UL)
+#define copy_to_user(to, from, n) (memcpy(to, from, n), 0UL)
+#define u64_to_user_ptr(x) ((void __user *)(uintptr_t)(x))
+#define compat_ptr_ioctl NULL
+#define noop_llseek NULL
+#define simple_open NULL
+
+struct seq_file { void *private; };
+struct dentry;
+#define seq_printf(s, ...) ((void)(s))
+#define seq_putc(s, c) ((void)(s))
+#define DEFINE_SHOW_ATTRIBUTE(__name) \
+	static const struct file_operations __name ## _fops = { .owner = THIS_MODULE }; \
+	static int (*const __name ## _host_show)(struct seq_file *, void *) __attribute__((unused)) = __name ## _show
+#define debugfs_create_dir(name, parent) ((struct dentry *)NULL)
+#define debugfs_create_file(name, mode, parent, data, fops) ((void)(fops))
+#define debugfs_remove_recursive(d) ((void)(d))
+
+/* tracepoints compile to nothing */
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { } \
+	static inline bool trace_##name##_enabled(void) { return false; }
+
+#endif /* _SI5351_HOST_H */
@@ -0,0 +1,139 @@
+/*
+ * mock.c: simulated Si5351 register file for the userspace benchmark
+ *
+ * Licensed under the GPL-2.
+ *
+ * Writes land in a plain array, the PLL reset register clears itself and
+ * the status registers always read 0, so every PLL reports lock at once.
+ * Transfers are split and counted the way si5351_i2c_bus and
+ * si5351_smbus_bus put them on a real bus.
+ */
+
+#include "mock.h"
+
+/* the driver state only knows its device, which is the mock's client */
+static struct si5351_mock *si5351_mock_of(struct si5351_state *st)
+{
+	return container_of(to_i2c_client(st->dev), struct si5351_mock, client);
+}
+
+void si5351_mock_init(struct si5351_mock *mock, const char *name, unsigned int bus_khz)
+{
+	memset(mock, 0, sizeof(*mock));
+	mock->client.dev.init_name = name;
+	mock->client.addr = SI5351_BUS_BASE_ADDR;
+	mock->bus_khz = bus_khz;
+}
+
+void si5351_mock_clear_counters(struct si5351_mock *mock)
+{
+	mock->read_xfers = 0;
+	mock->read_bytes = 0;
+	mock->write_xfers = 0;
+	mock->write_bytes = 0;
+	mock->pll_resets = 0;
+	memset(mock->written, 0, sizeof(mock->written));
+}
+
+/* @bytes on the wire, 9 clocks each with the ACK, start and stop ignored */
+static void si5351_mock_wire(struct si5351_mock *mock, unsigned int bytes)
+{
+	struct timespec ts;
+	u64 ns;
+
+	if (!mock->bus_khz)
+		return;
+
+	ns = (u64)bytes * 9 * 1000000 / mock->bus_khz;
+	ts.tv_sec = ns / NSEC_PER_SEC;
+	ts.tv_nsec = ns % NSEC_PER_SEC;
+	nanosleep(&ts, NULL);
+}
+
+/* status polls run without the bus lock, so the counters are atomic */
+static void si5351_mock_count(unsigned long long *xfers, unsigned long long *bytes, unsigned int n)
+{
+	__atomic_fetch_add(xfers, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(bytes, n, __ATOMIC_RELAXED);
+}
+
+static void si5351_mock_store(struct si5351_mock *mock, unsigned int reg, const u8 *val, unsigned int len)
+{
+	for (; len && reg < SI5351_REG_COUNT; reg++, val++, len--) {
+		mock->written[reg] = true;
+		if (reg == SI5351_PLL_RESET) {
+			if (*val)
+				mock->pll_resets++;
+			continue;
+		}
+		mock->regs[reg] = *val;
+	}
+}
+
+/* SMBus reads: single bytes, or I2C block reads of up to 32 bytes */
+static int si5351_mock_read(struct si5351_state *st, unsigned int reg, u8 *val, unsigned int len)
+{
+	struct si5351_mock *mock = si5351_mock_of(st);
+	unsigned int n;
+
+	if (reg + len > SI5351_REG_COUNT)
+		return -EINVAL;
+
+	for (; len; reg += n, val += n, len -= n) {
+		n = min_t(unsigned int, len, I2C_SMBUS_BLOCK_MAX);
+		memcpy(val, &mock->regs[reg], n);
+		if (reg <= SI5351_INTERRUPT_STATUS)
+			memset(val, 0, min(n, SI5351_INTERRUPT_STATUS + 1 - reg));
+		/* address and register out, address and data back */
+		si5351_mock_wire(mock, n + 3);
+		si5351_mock_count(&mock->read_xfers, &mock->read_bytes, n);
+	}
+
+	return 0;
+}
+
+/* every message of the commit is one transfer */
+static int si5351_mock_i2c_write(struct si5351_state *st)
+{
+	struct si5351_mock *mock = si5351_mock_of(st);
+	unsigned int i;
+
+	for (i = 0; i < st->num_msgs; i++) {
+		si5351_mock_store(mock, st->msgs[i].buf[0], &st->msgs[i].buf[1], st->msgs[i].len - 1);
+		si5351_mock_wire(mock, st->msgs[i].len + 1);
+		si5351_mock_count(&mock->write_xfers, &mock->write_bytes, st->msgs[i].len);
+	}
+
+	return 0;
+}
+
+/* SMBus block writes carry at most 32 data bytes each */
+static int si5351_mock_smbus_write(struct si5351_state *st)
+{
+	struct si5351_mock *mock = si5351_mock_of(st);
+	unsigned int i, reg, len, n;
+	const u8 *val;
+
+	for (i = 0; i < st->num_msgs; i++) {
+		reg = st->msgs[i].buf[0];
+		val = &st->msgs[i].buf[1];
+		for (len = st->msgs[i].len - 1; len; reg += n, val += n, len -= n) {
+			n = min_t(unsigned int, len, I2C_SMBUS_BLOCK_MAX);
+			si5351_mock_store(mock, reg, val, n);
+			si5351_mock_wire(mock, n + 2);
+			si5351_mock_count(&mock->write_xfers, &mock->write_bytes, n + 1);
+		}
+	}
+
+	return 0;
+}
+
+const struct si5351_bus_ops si5351_mock_i2c_bus = {
+	.read = si5351_mock_read,
+	.write = si5351_mock_i2c_write,
+};
+
+const struct si5351_bus_ops si5351_mock_smbus_bus = {
+	.read = si5351_mock_read,
+	.write = si5351_mock_smbus_write,
+};
@@ -0,0 +1,41 @@
+/*
+ * mock.h: simulated Si5351 register file for the userspace benchmark
+ *
+ * Licensed under the GPL-2.
+ */
+
+#ifndef _SI5351_MOCK_H
+#define _SI5351_MOCK_H
+
+#include "host.h"
+#include "si5351_defs.h"
+
+/*
+ * One simulated chip: the I2C client the driver state points at, its
+ * register file and the traffic it has seen. Bytes are counted after the
+ * address byte like the driver's debugfs statistics, so writes include
+ * the register number. With a bus clock set, every transfer also takes
+ * the time it would need on the wire, so chips on separate adapters
+ * overlap and the driver's bus lock is held for realistic times. "written"
+ * marks every register a write reached since the counters were cleared.
+ */
+struct si5351_mock {
+	struct i2c_client	client;
+	u8			regs[SI5351_REG_COUNT];
+	unsigned int		bus_khz;
+	unsigned long long	read_xfers;
+	unsigned long long	read_bytes;
+	unsigned long long	write_xfers;
+	unsigned long long	write_bytes;
+	unsigned long long	pll_resets;
+	bool			written[SI5351_REG_COUNT];
+};
+
+/* a plain I2C adapter, and one that only speaks SMBus */
+extern const struct si5351_bus_ops si5351_mock_i2c_bus;
+extern const struct si5351_bus_ops si5351_mock_smbus_bus;
+
+void si5351_mock_init(struct si5351_mock *mock, const char *name, unsigned int bus_khz);
+void si5351_mock_clear_counters(struct si5351_mock *mock);
+
+#endif /* _SI5351_MOCK_H */